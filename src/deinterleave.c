@@ -0,0 +1,315 @@
+#include <stddef.h>
+
+#include "deinterleave.h"
+
+// SSE2 is part of the x86-64 baseline. SSSE3 is used if the compiler is targeting it, or
+// otherwise, with GCC or Clang, if the processor turns out to support it at run time
+#if defined(__SSE2__) || defined(_M_X64)
+#define DEINTERLEAVE_SSE2
+#include <emmintrin.h>
+#if defined(__SSSE3__)
+#define DEINTERLEAVE_SSSE3
+#include <tmmintrin.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9))
+#define DEINTERLEAVE_SSSE3
+#define DEINTERLEAVE_SSSE3_DISPATCH
+#include <tmmintrin.h>
+#endif
+#endif
+
+// Images are processed in square tiles of this many rows and pixels, and
+// full tiles are visited in vertical bands of four, so that each segment of an
+// output column written in one pass fills whole cache lines
+#define TILE 16
+#define BAND (4 * TILE)
+
+// Deinterleave the region [i0,i1) x [j0,j1) of the image, tile by tile, where
+// the data start with row "first" of the image
+// This is the fallback for partial tiles, and for platforms without SSE2
+#define DEFINE_DEINTERLEAVE_REGION(name, type) \
+static void name (type *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned i0, const unsigned i1, const unsigned j0, const unsigned j1) \
+{ \
+    const size_t plane = (size_t) height * width, row_bytes = (size_t) width * channels; \
+    for (unsigned ti=i0; ti<i1; ti+=TILE) \
+    { \
+        const unsigned ti_end = (i1 - ti > TILE ? ti + TILE : i1); \
+        for (unsigned tj=j0; tj<j1; tj+=TILE) \
+        { \
+            const unsigned tj_end = (j1 - tj > TILE ? tj + TILE : j1); \
+            for (unsigned k=0; k<channels; k++) \
+            { \
+                for (unsigned j=tj; j<tj_end; j++) \
+                { \
+                    type *out = image + k * plane + (size_t) j * height; \
+                    const unsigned char *in = data + (size_t) j * channels + k; \
+                    for (unsigned i=ti; i<ti_end; i++) \
+                        out[i] = (type) in[(i - first) * row_bytes]; \
+                } \
+            } \
+        } \
+    } \
+}
+
+DEFINE_DEINTERLEAVE_REGION(deinterleave_region_int, int)
+DEFINE_DEINTERLEAVE_REGION(deinterleave_region_raw, unsigned char)
+
+#ifdef DEINTERLEAVE_SSE2
+
+#ifdef DEINTERLEAVE_SSSE3
+// Shuffle masks picking channel k of 16 RGB pixels out of each of three 16-byte blocks
+static const signed char rgb_masks[3][3][16] = {
+  { {  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13 } },
+  { {  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14 } },
+  { {  2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15 } }
+};
+
+// Load TILE rows of TILE RGB pixels, splitting them into channels with byte shuffles
+#ifdef DEINTERLEAVE_SSSE3_DISPATCH
+__attribute__((target("ssse3")))
+#endif
+static void load_rgb_tile_ssse3 (__m128i rows[4][TILE], const unsigned char *src, const size_t row_bytes)
+{
+    for (unsigned r=0; r<TILE; r++, src+=row_bytes)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *) src);
+        const __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        const __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        for (unsigned k=0; k<3; k++)
+        {
+            const __m128i from_a = _mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *) rgb_masks[k][0]));
+            const __m128i from_b = _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *) rgb_masks[k][1]));
+            const __m128i from_c = _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *) rgb_masks[k][2]));
+            rows[k][r] = _mm_or_si128(_mm_or_si128(from_a, from_b), from_c);
+        }
+    }
+}
+#endif
+
+// Whether the SSSE3 version of the RGB tile loader can be used
+static int have_ssse3 (void)
+{
+#if defined(DEINTERLEAVE_SSSE3_DISPATCH)
+    return __builtin_cpu_supports("ssse3");
+#elif defined(DEINTERLEAVE_SSSE3)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Load TILE rows of TILE pixels each, splitting them into one vector per channel and row
+static void load_tile (__m128i rows[4][TILE], const unsigned char *src, const size_t row_bytes, const unsigned channels, const int ssse3)
+{
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    
+    switch (channels)
+    {
+        case 1:
+        for (unsigned r=0; r<TILE; r++, src+=row_bytes)
+            rows[0][r] = _mm_loadu_si128((const __m128i *) src);
+        break;
+        
+        case 2:
+        // Even bytes are channel 0, odd bytes channel 1
+        for (unsigned r=0; r<TILE; r++, src+=row_bytes)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i *) src);
+            const __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+            rows[0][r] = _mm_packus_epi16(_mm_and_si128(a,low_bytes), _mm_and_si128(b,low_bytes));
+            rows[1][r] = _mm_packus_epi16(_mm_srli_epi16(a,8), _mm_srli_epi16(b,8));
+        }
+        break;
+        
+        case 3:
+#ifdef DEINTERLEAVE_SSSE3
+        if (ssse3)
+        {
+            load_rgb_tile_ssse3(rows, src, row_bytes);
+            break;
+        }
+#endif
+        for (unsigned r=0; r<TILE; r++, src+=row_bytes)
+        {
+            // SSE2 has no byte shuffle, so gather through a small buffer
+            unsigned char planes[3][TILE];
+            for (unsigned p=0; p<TILE; p++)
+            {
+                planes[0][p] = src[3*p];
+                planes[1][p] = src[3*p+1];
+                planes[2][p] = src[3*p+2];
+            }
+            for (unsigned k=0; k<3; k++)
+                rows[k][r] = _mm_loadu_si128((const __m128i *) planes[k]);
+        }
+        break;
+        
+        case 4:
+        // Split into even and odd bytes twice over
+        for (unsigned r=0; r<TILE; r++, src+=row_bytes)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i *) src);
+            const __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+            const __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+            const __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+            const __m128i even_lo = _mm_packus_epi16(_mm_and_si128(a,low_bytes), _mm_and_si128(b,low_bytes));
+            const __m128i even_hi = _mm_packus_epi16(_mm_and_si128(c,low_bytes), _mm_and_si128(d,low_bytes));
+            const __m128i odd_lo = _mm_packus_epi16(_mm_srli_epi16(a,8), _mm_srli_epi16(b,8));
+            const __m128i odd_hi = _mm_packus_epi16(_mm_srli_epi16(c,8), _mm_srli_epi16(d,8));
+            rows[0][r] = _mm_packus_epi16(_mm_and_si128(even_lo,low_bytes), _mm_and_si128(even_hi,low_bytes));
+            rows[1][r] = _mm_packus_epi16(_mm_and_si128(odd_lo,low_bytes), _mm_and_si128(odd_hi,low_bytes));
+            rows[2][r] = _mm_packus_epi16(_mm_srli_epi16(even_lo,8), _mm_srli_epi16(even_hi,8));
+            rows[3][r] = _mm_packus_epi16(_mm_srli_epi16(odd_lo,8), _mm_srli_epi16(odd_hi,8));
+        }
+        break;
+    }
+}
+
+// Transpose a 16 x 16 byte block in place, so that x[p] holds column p
+static void transpose_tile (__m128i x[TILE])
+{
+    __m128i a[16], b[16], c[16];
+    
+    // Interleave pairs of rows: a[h*8+m] holds rows 2m and 2m+1 for columns 8h to 8h+7
+    for (unsigned m=0; m<8; m++)
+    {
+        a[m] = _mm_unpacklo_epi8(x[2*m], x[2*m+1]);
+        a[m+8] = _mm_unpackhi_epi8(x[2*m], x[2*m+1]);
+    }
+    
+    // Then quads of rows: b[q*4+s] holds rows 4s to 4s+3 for columns 4q to 4q+3
+    for (unsigned h=0; h<2; h++)
+    {
+        for (unsigned s=0; s<4; s++)
+        {
+            b[(2*h)*4+s] = _mm_unpacklo_epi16(a[h*8+2*s], a[h*8+2*s+1]);
+            b[(2*h+1)*4+s] = _mm_unpackhi_epi16(a[h*8+2*s], a[h*8+2*s+1]);
+        }
+    }
+    
+    // Then octets: c[p*2+s] holds rows 8s to 8s+7 for columns 2p and 2p+1
+    for (unsigned q=0; q<4; q++)
+    {
+        for (unsigned s=0; s<2; s++)
+        {
+            c[(2*q)*2+s] = _mm_unpacklo_epi32(b[q*4+2*s], b[q*4+2*s+1]);
+            c[(2*q+1)*2+s] = _mm_unpackhi_epi32(b[q*4+2*s], b[q*4+2*s+1]);
+        }
+    }
+    
+    // Finally combine the two halves of each column
+    for (unsigned p=0; p<8; p++)
+    {
+        x[2*p] = _mm_unpacklo_epi64(c[p*2], c[p*2+1]);
+        x[2*p+1] = _mm_unpackhi_epi64(c[p*2], c[p*2+1]);
+    }
+}
+
+// Deinterleave one full tile whose top-left corner is at (i0,j0), where the data start with row "first"
+static void deinterleave_tile_int (int *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned i0, const unsigned j0, const int ssse3)
+{
+    const size_t plane = (size_t) height * width, row_bytes = (size_t) width * channels;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rows[4][TILE];
+    
+    load_tile(rows, data + (size_t) (i0 - first) * row_bytes + (size_t) j0 * channels, row_bytes, channels, ssse3);
+    for (unsigned k=0; k<channels; k++)
+    {
+        transpose_tile(rows[k]);
+        for (unsigned p=0; p<TILE; p++)
+        {
+            // Widen each byte to a 32-bit integer
+            __m128i *out = (__m128i *) (image + k * plane + (size_t) (j0 + p) * height + i0);
+            const __m128i lo = _mm_unpacklo_epi8(rows[k][p], zero);
+            const __m128i hi = _mm_unpackhi_epi8(rows[k][p], zero);
+            _mm_storeu_si128(out, _mm_unpacklo_epi16(lo,zero));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo,zero));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi,zero));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi,zero));
+        }
+    }
+}
+
+static void deinterleave_tile_raw (unsigned char *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned i0, const unsigned j0, const int ssse3)
+{
+    const size_t plane = (size_t) height * width, row_bytes = (size_t) width * channels;
+    __m128i rows[4][TILE];
+    
+    load_tile(rows, data + (size_t) (i0 - first) * row_bytes + (size_t) j0 * channels, row_bytes, channels, ssse3);
+    for (unsigned k=0; k<channels; k++)
+    {
+        transpose_tile(rows[k]);
+        for (unsigned p=0; p<TILE; p++)
+            _mm_storeu_si128((__m128i *) (image + k * plane + (size_t) (j0 + p) * height + i0), rows[k][p]);
+    }
+}
+
+#endif
+
+void deinterleave_rows_int (int *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned count)
+{
+    const unsigned end = first + count;
+#ifdef DEINTERLEAVE_SSE2
+    if (channels >= 1 && channels <= 4)
+    {
+        const unsigned full_end = end - count % TILE, full_width = width - width % TILE;
+        const int ssse3 = (channels == 3 && have_ssse3());
+        for (unsigned i0=first; i0<full_end; i0+=BAND)
+        {
+            const unsigned band_end = (full_end - i0 > BAND ? i0 + BAND : full_end);
+            for (unsigned j0=0; j0<full_width; j0+=TILE)
+            {
+                for (unsigned i=i0; i<band_end; i+=TILE)
+                    deinterleave_tile_int(image, data, width, height, channels, first, i, j0, ssse3);
+            }
+        }
+        
+        // Partial tiles at the right and bottom edges
+        deinterleave_region_int(image, data, width, height, channels, first, first, full_end, full_width, width);
+        deinterleave_region_int(image, data, width, height, channels, first, full_end, end, 0, width);
+        return;
+    }
+#endif
+    deinterleave_region_int(image, data, width, height, channels, first, first, end, 0, width);
+}
+
+void deinterleave_rows_raw (unsigned char *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned count)
+{
+    const unsigned end = first + count;
+#ifdef DEINTERLEAVE_SSE2
+    if (channels >= 1 && channels <= 4)
+    {
+        const unsigned full_end = end - count % TILE, full_width = width - width % TILE;
+        const int ssse3 = (channels == 3 && have_ssse3());
+        for (unsigned i0=first; i0<full_end; i0+=BAND)
+        {
+            const unsigned band_end = (full_end - i0 > BAND ? i0 + BAND : full_end);
+            for (unsigned j0=0; j0<full_width; j0+=TILE)
+            {
+                for (unsigned i=i0; i<band_end; i+=TILE)
+                    deinterleave_tile_raw(image, data, width, height, channels, first, i, j0, ssse3);
+            }
+        }
+        
+        deinterleave_region_raw(image, data, width, height, channels, first, first, full_end, full_width, width);
+        deinterleave_region_raw(image, data, width, height, channels, first, full_end, end, 0, width);
+        return;
+    }
+#endif
+    deinterleave_region_raw(image, data, width, height, channels, first, first, end, 0, width);
+}
+
+void deinterleave_int (int *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels)
+{
+    deinterleave_rows_int(image, data, width, height, channels, 0, height);
+}
+
+void deinterleave_raw (unsigned char *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels)
+{
+    deinterleave_rows_raw(image, data, width, height, channels, 0, height);
+}
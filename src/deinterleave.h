@@ -0,0 +1,13 @@
+#ifndef _DEINTERLEAVE_H_
+#define _DEINTERLEAVE_H_
+
+// Convert LodePNG's row-major, channel-interleaved 8-bit data into R's
+// column-major (height x width x channels) layout, with integer or byte elements
+void deinterleave_int (int *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels);
+void deinterleave_raw (unsigned char *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels);
+
+// The same for a band of consecutive rows, where the data hold only rows first to first+count-1 of the image
+void deinterleave_rows_int (int *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned count);
+void deinterleave_rows_raw (unsigned char *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned first, const unsigned count);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "downscale.h"
+
+void downscale_add_row (unsigned *sums, const unsigned char *row, const unsigned width, const unsigned channels, const unsigned factor)
+{
+    unsigned *sum = sums;
+    for (unsigned j0=0; j0<width; j0+=factor)
+    {
+        const unsigned cols = (width - j0 > factor ? factor : width - j0);
+        for (unsigned j=0; j<cols; j++)
+        {
+            for (unsigned k=0; k<channels; k++)
+                sum[k] += *row++;
+        }
+        sum += channels;
+    }
+}
+
+// Divide each sum by the number of pixels in its box, rounding to the nearest value
+void downscale_finish_row (unsigned char *out, const unsigned *sums, const unsigned width, const unsigned channels, const unsigned factor, const unsigned rows)
+{
+    for (unsigned j0=0, l=0; j0<width; j0+=factor)
+    {
+        const unsigned n = rows * (width - j0 > factor ? factor : width - j0);
+        for (unsigned k=0; k<channels; k++, l++)
+            out[l] = (unsigned char) ((sums[l] + n / 2) / n);
+    }
+}
+
+unsigned downscale (unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned factor)
+{
+    const unsigned out_width = (width + factor - 1) / factor;
+    const size_t row_bytes = (size_t) width * channels, out_row_bytes = (size_t) out_width * channels;
+    
+    // Box sums for one row of output pixels
+    unsigned *sums = (unsigned *) malloc(out_row_bytes * sizeof(unsigned));
+    if (sums == NULL)
+        return 83;
+    
+    // Each output row ends before the first input row that is still to be read, so working in place is safe
+    for (unsigned i0=0; i0<height; i0+=factor)
+    {
+        const unsigned rows = (height - i0 > factor ? factor : height - i0);
+        memset(sums, 0, out_row_bytes * sizeof(unsigned));
+        for (unsigned i=i0; i<i0+rows; i++)
+            downscale_add_row(sums, data + (size_t) i * row_bytes, width, channels, factor);
+        downscale_finish_row(data + (size_t) (i0 / factor) * out_row_bytes, sums, width, channels, factor, rows);
+    }
+    
+    free(sums);
+    return 0;
+}
+
+void subsample_row (unsigned char *out, const unsigned char *row, const unsigned width, const unsigned channels, const unsigned factor)
+{
+    for (unsigned j=0; j<width; j+=factor)
+    {
+        for (unsigned k=0; k<channels; k++)
+            *out++ = row[(size_t) j * channels + k];
+    }
+}
+
+void subsample (unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned factor)
+{
+    const size_t row_bytes = (size_t) width * channels, out_row_bytes = (size_t) ((width + factor - 1) / factor) * channels;
+    for (unsigned i=0; i<height; i+=factor)
+        subsample_row(data + (size_t) (i / factor) * out_row_bytes, data + (size_t) i * row_bytes, width, channels, factor);
+}
@@ -0,0 +1,23 @@
+#ifndef _DOWNSCALE_H_
+#define _DOWNSCALE_H_
+
+// Shrink 8-bit interleaved pixel data in place by an integer factor in each
+// dimension, averaging over boxes of pixels (which are smaller at the right and
+// bottom edges if the dimensions are not multiples of the factor)
+// Returns zero or a LodePNG error code
+unsigned downscale (unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned factor);
+
+// The same one row at a time: add a row of input pixels to the box sums for a
+// row of output pixels, and once the last row of the boxes has been added,
+// divide by the number of pixels in each box, given the number of rows added
+void downscale_add_row (unsigned *sums, const unsigned char *row, const unsigned width, const unsigned channels, const unsigned factor);
+void downscale_finish_row (unsigned char *out, const unsigned *sums, const unsigned width, const unsigned channels, const unsigned factor, const unsigned rows);
+
+// Shrink the same way by keeping the top-left pixel of each box, for data such
+// as palette indices that can't meaningfully be averaged
+void subsample (unsigned char *data, const unsigned width, const unsigned height, const unsigned channels, const unsigned factor);
+
+// The same for one row, which should be the first row of a box
+void subsample_row (unsigned char *out, const unsigned char *row, const unsigned width, const unsigned channels, const unsigned factor);
+
+#endif
@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include <R.h>
+
+#include "interleave.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define INTERLEAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Integer windows up to this width are quantised through a lookup table
+#define MAX_LOOKUP_SIZE 65536
+
+// Images are quantised in blocks of this many rows and columns, reading
+// contiguous column segments and writing whole rows of each block
+#define BLOCK 64
+
+// Scaled values this close to a rounding tie are recomputed with the reference
+// formula, so that multiplying by a precomputed scale gives identical results
+#define TIE_EPSILON 1e-6
+
+// Everything a quantisation kernel needs to know about the intensity window
+typedef struct {
+    double min, window, scale;
+    const unsigned char *lookup;
+    int offset, size;
+} quantiser;
+
+// Quantise a contiguous run of source values into bytes
+typedef void (*quantise_fn) (unsigned char *out, const void *in, const size_t n, const quantiser *q);
+
+// The reference quantisation of a single value; NaN (including NA) maps to zero
+static inline unsigned char quantise (const double value, const double min, const double window)
+{
+    const double result = round((value - min) / window * 255.0);
+    if (result > 255.0)
+        return 255;
+    else if (result >= 0.0)
+        return (unsigned char) result;
+    else
+        return 0;
+}
+
+// The same, using the precomputed scale except near ties
+static inline unsigned char quantise_scaled (const double value, const quantiser *q)
+{
+    const double shifted = (value - q->min) * q->scale + 0.5;
+    if (!(shifted > 0.5))
+        return 0;
+    else if (shifted >= 255.5)
+        return 255;
+    
+    const double result = floor(shifted);
+    const double fraction = shifted - result;
+    if (fraction < TIE_EPSILON || fraction > 1.0 - TIE_EPSILON)
+        return quantise(value, q->min, q->window);
+    else
+        return (unsigned char) result;
+}
+
+static void quantise_real (unsigned char *out, const void *in, const size_t n, const quantiser *q)
+{
+    const double *values = (const double *) in;
+    size_t l = 0;
+
+#ifdef INTERLEAVE_SSE2
+    const __m128d min = _mm_set1_pd(q->min), scale = _mm_set1_pd(q->scale);
+    const __m128d half = _mm_set1_pd(0.5), zero = _mm_setzero_pd(), top = _mm_set1_pd(255.0), upper = _mm_set1_pd(255.5);
+    const __m128d epsilon = _mm_set1_pd(TIE_EPSILON), one_less_epsilon = _mm_set1_pd(1.0 - TIE_EPSILON);
+    for (; l+8<=n; l+=8)
+    {
+        __m128i results[4];
+        int ties = 0;
+        for (unsigned p=0; p<4; p++)
+        {
+            // Clamping to [0,255] before truncation also sends NaN to zero
+            const __m128d shifted = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(values+l+2*p), min), scale), half);
+            const __m128d clamped = _mm_min_pd(_mm_max_pd(shifted, zero), top);
+            results[p] = _mm_cvttpd_epi32(clamped);
+            
+            // Flag values close to a tie, within the unclamped range
+            const __m128d fraction = _mm_sub_pd(clamped, _mm_cvtepi32_pd(results[p]));
+            const __m128d near = _mm_or_pd(_mm_cmplt_pd(fraction, epsilon), _mm_cmpgt_pd(fraction, one_less_epsilon));
+            const __m128d inside = _mm_and_pd(_mm_cmpgt_pd(shifted, half), _mm_cmplt_pd(shifted, upper));
+            ties |= _mm_movemask_pd(_mm_and_pd(near, inside)) << (2*p);
+        }
+        
+        // Narrow the eight 32-bit results to bytes
+        const __m128i lo = _mm_unpacklo_epi64(results[0], results[1]);
+        const __m128i hi = _mm_unpacklo_epi64(results[2], results[3]);
+        _mm_storel_epi64((__m128i *) (out + l), _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128()));
+        
+        if (ties)
+        {
+            for (unsigned p=0; p<8; p++)
+            {
+                if (ties & (1 << p))
+                    out[l+p] = quantise(values[l+p], q->min, q->window);
+            }
+        }
+    }
+#endif
+    
+    for (; l<n; l++)
+        out[l] = quantise_scaled(values[l], q);
+}
+
+// Integers in the default window need only clamping, since NA_INTEGER is negative
+static void quantise_int_clamp (unsigned char *out, const void *in, const size_t n, const quantiser *q)
+{
+    const int *values = (const int *) in;
+    size_t l = 0;
+
+#ifdef INTERLEAVE_SSE2
+    // Saturating packs from 32 to 16 to 8 bits are exactly a clamp to [0,255]
+    for (; l+16<=n; l+=16)
+    {
+        const __m128i a = _mm_packs_epi32(_mm_loadu_si128((const __m128i *) (values+l)), _mm_loadu_si128((const __m128i *) (values+l+4)));
+        const __m128i b = _mm_packs_epi32(_mm_loadu_si128((const __m128i *) (values+l+8)), _mm_loadu_si128((const __m128i *) (values+l+12)));
+        _mm_storeu_si128((__m128i *) (out + l), _mm_packus_epi16(a, b));
+    }
+#endif
+    
+    for (; l<n; l++)
+        out[l] = (values[l] > 255 ? 255 : (values[l] < 0 ? 0 : (unsigned char) values[l]));
+}
+
+// Narrow windows use a table of exactly quantised values; those outside clamp to 0 or 255
+static void quantise_int_lookup (unsigned char *out, const void *in, const size_t n, const quantiser *q)
+{
+    const int *values = (const int *) in;
+    for (size_t l=0; l<n; l++)
+    {
+        const int value = values[l];
+        if (value == NA_INTEGER || value < q->offset)
+            out[l] = 0;
+        else if (value - q->offset >= q->size)
+            out[l] = 255;
+        else
+            out[l] = q->lookup[value - q->offset];
+    }
+}
+
+static void quantise_int_scaled (unsigned char *out, const void *in, const size_t n, const quantiser *q)
+{
+    const int *values = (const int *) in;
+    for (size_t l=0; l<n; l++)
+        out[l] = (values[l] == NA_INTEGER ? 0 : quantise_scaled((double) values[l], q));
+}
+
+static void quantise_raw (unsigned char *out, const void *in, const size_t n, const quantiser *q)
+{
+    const unsigned char *values = (const unsigned char *) in;
+    for (size_t l=0; l<n; l++)
+        out[l] = q->lookup[values[l]];
+}
+
+// Quantise the image block by block: each column segment is quantised into a
+// small buffer that stays in cache, from which rows of the output are written
+static void interleave (unsigned char *data, const char *image, const size_t element_size, const unsigned width, const unsigned height, const unsigned channels, quantise_fn kernel, const quantiser *q)
+{
+    unsigned char block[4][BLOCK][BLOCK];
+    const size_t plane = (size_t) height * width;
+    
+    for (unsigned i0=0; i0<height; i0+=BLOCK)
+    {
+        const unsigned rows = (height - i0 > BLOCK ? BLOCK : height - i0);
+        for (unsigned j0=0; j0<width; j0+=BLOCK)
+        {
+            const unsigned cols = (width - j0 > BLOCK ? BLOCK : width - j0);
+            for (unsigned k=0; k<channels; k++)
+            {
+                for (unsigned j=0; j<cols; j++)
+                    kernel(block[k][j], image + element_size * (k * plane + (size_t) (j0 + j) * height + i0), rows, q);
+            }
+            
+            for (unsigned r=0; r<rows; r++)
+            {
+                unsigned char *out = data + ((size_t) (i0 + r) * width + j0) * channels;
+                for (unsigned j=0; j<cols; j++)
+                {
+                    for (unsigned k=0; k<channels; k++)
+                        *out++ = block[k][j][r];
+                }
+            }
+        }
+    }
+}
+
+int range_int (const int *image, const size_t length, double *min, double *max)
+{
+    int has_na = 0, lower = INT_MAX, upper = INT_MIN;
+    for (size_t l=0; l<length; l++)
+    {
+        const int value = image[l];
+        if (value == NA_INTEGER)
+            has_na = 1;
+        else
+        {
+            if (value < lower)
+                lower = value;
+            if (value > upper)
+                upper = value;
+        }
+    }
+    
+    // Leave the range empty if there are no valid values
+    if (lower <= upper)
+    {
+        *min = (double) lower;
+        *max = (double) upper;
+    }
+    return has_na;
+}
+
+int range_real (const double *image, const size_t length, double *min, double *max)
+{
+    double lower = *min, upper = *max;
+    int has_na = 0;
+    size_t l = 0;
+
+#ifdef INTERLEAVE_SSE2
+    // MINPD and MAXPD return their second argument if either is NaN, so missing values are skipped
+    __m128d lower_v[2] = { _mm_set1_pd(lower), _mm_set1_pd(lower) };
+    __m128d upper_v[2] = { _mm_set1_pd(upper), _mm_set1_pd(upper) };
+    __m128d na_v = _mm_setzero_pd();
+    for (; l+4<=length; l+=4)
+    {
+        for (unsigned p=0; p<2; p++)
+        {
+            const __m128d value = _mm_loadu_pd(image+l+2*p);
+            lower_v[p] = _mm_min_pd(value, lower_v[p]);
+            upper_v[p] = _mm_max_pd(value, upper_v[p]);
+            na_v = _mm_or_pd(na_v, _mm_cmpunord_pd(value, value));
+        }
+    }
+    
+    double lanes[4];
+    _mm_storeu_pd(lanes, _mm_min_pd(lower_v[0], lower_v[1]));
+    lower = (lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+    _mm_storeu_pd(lanes+2, _mm_max_pd(upper_v[0], upper_v[1]));
+    upper = (lanes[2] > lanes[3] ? lanes[2] : lanes[3]);
+    has_na = (_mm_movemask_pd(na_v) != 0);
+#endif
+    
+    for (; l<length; l++)
+    {
+        const double value = image[l];
+        if (ISNAN(value))
+            has_na = 1;
+        else
+        {
+            if (value < lower)
+                lower = value;
+            if (value > upper)
+                upper = value;
+        }
+    }
+    
+    *min = lower;
+    *max = upper;
+    return has_na;
+}
+
+void interleave_int (unsigned char *data, const int *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max)
+{
+    quantiser q = { min, max - min, 255.0 / (max - min), NULL, 0, 0 };
+    
+    if (min == 0.0 && max == 255.0)
+    {
+        interleave(data, (const char *) image, sizeof(int), width, height, channels, quantise_int_clamp, &q);
+        return;
+    }
+    
+    // If the window is narrow enough, tabulate the quantised value of every integer inside it
+    const double lower = ceil(min), upper = floor(max);
+    if (q.window > 0.0 && upper - lower < MAX_LOOKUP_SIZE && lower > (double) INT_MIN && upper < (double) INT_MAX)
+    {
+        unsigned char *lookup;
+        q.offset = (int) lower;
+        q.size = (int) (upper - lower) + 1;
+        lookup = (unsigned char *) malloc(q.size);
+        if (lookup != NULL)
+        {
+            for (int l=0; l<q.size; l++)
+                lookup[l] = quantise((double) (q.offset + l), min, q.window);
+            q.lookup = lookup;
+            
+            interleave(data, (const char *) image, sizeof(int), width, height, channels, quantise_int_lookup, &q);
+            free(lookup);
+            return;
+        }
+    }
+    
+    interleave(data, (const char *) image, sizeof(int), width, height, channels, quantise_int_scaled, &q);
+}
+
+void interleave_real (unsigned char *data, const double *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max)
+{
+    const quantiser q = { min, max - min, 255.0 / (max - min), NULL, 0, 0 };
+    interleave(data, (const char *) image, sizeof(double), width, height, channels, quantise_real, &q);
+}
+
+void interleave_raw (unsigned char *data, const unsigned char *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max)
+{
+    // Raw data can only take 256 values, so quantise through a lookup table
+    unsigned char lookup[256];
+    for (int l=0; l<256; l++)
+        lookup[l] = quantise((double) l, min, max - min);
+    
+    const quantiser q = { min, max - min, 255.0 / (max - min), lookup, 0, 256 };
+    interleave(data, (const char *) image, 1, width, height, channels, quantise_raw, &q);
+}
@@ -0,0 +1,18 @@
+#ifndef _INTERLEAVE_H_
+#define _INTERLEAVE_H_
+
+#include <stddef.h>
+
+// Find the range of the non-missing values in an array, returning nonzero if any are missing
+// The range is only updated if there are valid values
+int range_int (const int *image, const size_t length, double *min, double *max);
+int range_real (const double *image, const size_t length, double *min, double *max);
+
+// Quantise R's column-major (height x width x channels) data to 8 bits, using
+// the intensity window [min,max], and interleave it into LodePNG's row-major
+// layout; missing values become zero
+void interleave_int (unsigned char *data, const int *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max);
+void interleave_real (unsigned char *data, const double *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max);
+void interleave_raw (unsigned char *data, const unsigned char *image, const unsigned width, const unsigned height, const unsigned channels, const double min, const double max);
+
+#endif
@@ -39,6 +39,17 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+#ifdef _OPENMP
+#include <omp.h> /* loder extension: thread numbers for the row pipeline */
+#endif /* _OPENMP */
+
+/*loder extension: with GCC or Clang on x86, checksums and row filters use SIMD instructions chosen at run time
+according to what the CPU supports, so that the library itself need not be compiled for any particular instruction set*/
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9))
+#define LODEPNG_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -293,6 +304,50 @@ static ucvector ucvector_init(unsigned char* buffer, size_t size) {
   return v;
 }
 
+/*loder extension: see lodepng_workspace_new*/
+struct LodePNGWorkspace {
+  struct Hash* hash; /*LZ77 hash tables of the encoder, allocated for hash_windowsize*/
+  unsigned hash_windowsize;
+  size_t hash_used; /*number of bytes encoded since the hash tables were last reset*/
+  ucvector scanlines; /*decompressed scanlines of the decoder*/
+};
+
+#ifdef LODEPNG_COMPILE_DECODER
+/*loder extension: one of the pieces of input that is split over several places, such as the image data
+of a PNG in its IDAT chunks, which is then read in place rather than being concatenated first. Each piece
+records its offset within the whole, and none is empty unless it is the only one*/
+typedef struct LodePNGPiece {
+  const unsigned char* data;
+  size_t size;
+  size_t offset;
+} LodePNGPiece;
+
+/*index of the piece holding the byte at pos, or of the last piece if pos is beyond them*/
+static size_t pieces_find(const LodePNGPiece* pieces, size_t numpieces, size_t pos) {
+  size_t lo = 0, hi = numpieces - 1u;
+  while(lo < hi) {
+    size_t mid = (lo + hi + 1u) >> 1u;
+    if(pieces[mid].offset <= pos) lo = mid;
+    else hi = mid - 1u;
+  }
+  return lo;
+}
+
+/*copy n bytes from byte pos on of the whole, which must all be within it*/
+static void pieces_copy(unsigned char* dest, const LodePNGPiece* pieces, size_t numpieces, size_t pos, size_t n) {
+  size_t k = pieces_find(pieces, numpieces, pos);
+  while(n) {
+    size_t start = pos - pieces[k].offset;
+    size_t count = LODEPNG_MIN(n, pieces[k].size - start);
+    lodepng_memcpy(dest, pieces[k].data + start, count);
+    dest += count;
+    pos += count;
+    n -= count;
+    ++k;
+  }
+}
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_PNG
@@ -459,28 +514,77 @@ static void writeBitsReversed(LodePNGBitWriter* writer, unsigned value, size_t n
 #ifdef LODEPNG_COMPILE_DECODER
 
 typedef struct {
-  const unsigned char* data;
+  const unsigned char* data; /*loder extension: the part of the input in view, starting at byte base*/
   size_t size; /*size of data in bytes*/
-  size_t bitsize; /*size of data in bits, end of valid bp values, should be 8*size*/
+  size_t bitsize; /*end of valid bp values, 8 times the end of the input*/
   size_t bp;
   unsigned buffer; /*buffer for reading bits. NOTE: 'unsigned' must support at least 32 bits*/
+  /*loder extension: the input may be split into pieces, which are brought into view in turn. Near the end
+  of a piece, the next few bytes are copied together into seam instead*/
+  size_t base;
+  const LodePNGPiece* pieces;
+  size_t numpieces, piece;
+  unsigned char seam[16];
 } LodePNGBitReader;
 
-/* data size argument is in bytes. Returns error if size too large causing overflow */
-static unsigned LodePNGBitReader_init(LodePNGBitReader* reader, const unsigned char* data, size_t size) {
+/*loder extension: bring the byte at pos into view, with as many of those after it as are in the same piece,
+or at least 8 if they are not*/
+static void LodePNGBitReader_view(LodePNGBitReader* reader, size_t pos) {
+  const LodePNGPiece* pieces = reader->pieces;
+  size_t k = reader->piece, end = reader->bitsize >> 3u;
+  while(k > 0 && pos < pieces[k].offset) --k;
+  while(k + 1u < reader->numpieces && pos >= pieces[k + 1u].offset) ++k;
+  reader->piece = k;
+  if(k + 1u < reader->numpieces && pieces[k + 1u].offset - pos < 8u && pos < end) {
+    reader->size = LODEPNG_MIN(sizeof(reader->seam), end - pos);
+    pieces_copy(reader->seam, pieces, reader->numpieces, pos, reader->size);
+    reader->data = reader->seam;
+    reader->base = pos;
+  } else {
+    reader->data = pieces[k].data;
+    reader->base = pieces[k].offset;
+    reader->size = reader->base < end ? LODEPNG_MIN(pieces[k].size, end - reader->base) : 0;
+  }
+}
+
+/* Returns error if size too large causing overflow.
+loder extension: the input is from byte start to byte end of the given pieces, and bit positions count
+from the beginning of the first piece */
+static unsigned LodePNGBitReader_init(LodePNGBitReader* reader, const LodePNGPiece* pieces, size_t numpieces,
+                                      size_t start, size_t end) {
   size_t temp;
-  reader->data = data;
-  reader->size = size;
   /* size in bits, return error if overflow (if size_t is 32 bit this supports up to 500MB)  */
-  if(lodepng_mulofl(size, 8u, &reader->bitsize)) return 105;
+  if(lodepng_mulofl(end, 8u, &reader->bitsize)) return 105;
   /*ensure incremented bp can be compared to bitsize without overflow even when it would be incremented 32 too much and
   trying to ensure 32 more bits*/
   if(lodepng_addofl(reader->bitsize, 64u, &temp)) return 105;
-  reader->bp = 0;
+  reader->bp = start * 8u;
   reader->buffer = 0;
+  reader->pieces = pieces;
+  reader->numpieces = numpieces;
+  reader->piece = pieces_find(pieces, numpieces, start);
+  LodePNGBitReader_view(reader, start);
   return 0; /*ok*/
 }
 
+/*loder extension: bring the input from the end of the view on into view, returning where it now is*/
+static const unsigned char* LodePNGBitReader_next(LodePNGBitReader* reader) {
+  size_t pos = reader->base + reader->size;
+  LodePNGBitReader_view(reader, pos);
+  return reader->data + (pos - reader->base);
+}
+
+/*loder extension: the index in view of the byte at the bit pointer, first bringing it into view with the
+n - 1 bytes after it if they are in another piece*/
+static LODEPNG_INLINE size_t LodePNGBitReader_start(LodePNGBitReader* reader, size_t n) {
+  size_t start = (reader->bp >> 3u) - reader->base;
+  if((start >= reader->size || reader->size - start < n) && reader->numpieces > 1u) {
+    LodePNGBitReader_view(reader, reader->bp >> 3u);
+    start = (reader->bp >> 3u) - reader->base;
+  }
+  return start;
+}
+
 /*
 ensureBits functions:
 Ensures the reader can at least read nbits bits in one or more readBits calls,
@@ -491,7 +595,7 @@ checking for amount of bits must be done beforehand.
 
 /*See ensureBits documentation above. This one ensures up to 9 bits */
 static LODEPNG_INLINE void ensureBits9(LodePNGBitReader* reader, size_t nbits) {
-  size_t start = reader->bp >> 3u;
+  size_t start = LodePNGBitReader_start(reader, 2u);
   size_t size = reader->size;
   if(start + 1u < size) {
     reader->buffer = (unsigned)reader->data[start + 0] | ((unsigned)reader->data[start + 1] << 8u);
@@ -506,7 +610,7 @@ static LODEPNG_INLINE void ensureBits9(LodePNGBitReader* reader, size_t nbits) {
 
 /*See ensureBits documentation above. This one ensures up to 17 bits */
 static LODEPNG_INLINE void ensureBits17(LodePNGBitReader* reader, size_t nbits) {
-  size_t start = reader->bp >> 3u;
+  size_t start = LodePNGBitReader_start(reader, 3u);
   size_t size = reader->size;
   if(start + 2u < size) {
     reader->buffer = (unsigned)reader->data[start + 0] | ((unsigned)reader->data[start + 1] << 8u) |
@@ -523,7 +627,7 @@ static LODEPNG_INLINE void ensureBits17(LodePNGBitReader* reader, size_t nbits)
 
 /*See ensureBits documentation above. This one ensures up to 25 bits */
 static LODEPNG_INLINE void ensureBits25(LodePNGBitReader* reader, size_t nbits) {
-  size_t start = reader->bp >> 3u;
+  size_t start = LodePNGBitReader_start(reader, 4u);
   size_t size = reader->size;
   if(start + 3u < size) {
     reader->buffer = (unsigned)reader->data[start + 0] | ((unsigned)reader->data[start + 1] << 8u) |
@@ -539,26 +643,6 @@ static LODEPNG_INLINE void ensureBits25(LodePNGBitReader* reader, size_t nbits)
   (void)nbits;
 }
 
-/*See ensureBits documentation above. This one ensures up to 32 bits */
-static LODEPNG_INLINE void ensureBits32(LodePNGBitReader* reader, size_t nbits) {
-  size_t start = reader->bp >> 3u;
-  size_t size = reader->size;
-  if(start + 4u < size) {
-    reader->buffer = (unsigned)reader->data[start + 0] | ((unsigned)reader->data[start + 1] << 8u) |
-                     ((unsigned)reader->data[start + 2] << 16u) | ((unsigned)reader->data[start + 3] << 24u);
-    reader->buffer >>= (reader->bp & 7u);
-    reader->buffer |= (((unsigned)reader->data[start + 4] << 24u) << (8u - (reader->bp & 7u)));
-  } else {
-    reader->buffer = 0;
-    if(start + 0u < size) reader->buffer |= reader->data[start + 0];
-    if(start + 1u < size) reader->buffer |= ((unsigned)reader->data[start + 1] << 8u);
-    if(start + 2u < size) reader->buffer |= ((unsigned)reader->data[start + 2] << 16u);
-    if(start + 3u < size) reader->buffer |= ((unsigned)reader->data[start + 3] << 24u);
-    reader->buffer >>= (reader->bp & 7u);
-  }
-  (void)nbits;
-}
-
 /* Get bits without advancing the bit pointer. Must have enough bits available with ensureBits. Max nbits is 31. */
 static LODEPNG_INLINE unsigned peekBits(LodePNGBitReader* reader, size_t nbits) {
   /* The shift allows nbits to be only up to 31. */
@@ -1032,7 +1116,6 @@ static unsigned HuffmanTree_makeFromFrequencies(HuffmanTree* tree, const unsigne
   if(!error) error = HuffmanTree_makeFromLengths2(tree);
   return error;
 }
-#endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*get the literal and length code tree of a deflated block with fixed tree, as per the deflate specification*/
 static unsigned generateFixedLitLenTree(HuffmanTree* tree) {
@@ -1065,6 +1148,7 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree) {
   lodepng_free(bitlen);
   return error;
 }
+#endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
 
@@ -1087,30 +1171,353 @@ static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree*
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Adler32                                                                / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+#ifdef LODEPNG_X86_DISPATCH
+/*loder extension: SSSE3 adler32 of len bytes, len a multiple of 32. Each byte is weighted by its distance from
+the end of its 32-byte block for s2, and the running s1 is added to s2 once per byte via the block count*/
+__attribute__((target("ssse3")))
+static unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data, unsigned len) {
+  unsigned s1 = adler & 0xffffu;
+  unsigned s2 = (adler >> 16u) & 0xffffu;
+  unsigned blocks = len / 32u;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+
+  while(blocks != 0u) {
+    /*as many blocks as keep the sums from overflowing, as in the scalar version*/
+    unsigned n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m128i v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+    __m128i v_s1 = zero;
+    blocks -= n;
+    do {
+      const __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      const __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+    } while(--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+    /*horizontal sums of the four lanes*/
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+
+/*loder extension: the same with AVX2, for len a multiple of 64*/
+__attribute__((target("avx2")))
+static unsigned update_adler32_avx2(unsigned adler, const unsigned char* data, unsigned len) {
+  unsigned s1 = adler & 0xffffu;
+  unsigned s2 = (adler >> 16u) & 0xffffu;
+  unsigned blocks = len / 64u;
+  const __m256i tap1 = _mm256_setr_epi8(64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49,
+                                        48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33);
+  const __m256i tap2 = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+
+  while(blocks != 0u) {
+    unsigned n = blocks > 5552u / 64u ? 5552u / 64u : blocks;
+    __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s1 = zero;
+    __m128i h1, h2;
+    blocks -= n;
+    do {
+      const __m256i bytes1 = _mm256_loadu_si256((const __m256i*)data);
+      const __m256i bytes2 = _mm256_loadu_si256((const __m256i*)(data + 32));
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes1, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes2, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes2, tap2), ones));
+      data += 64;
+    } while(--n);
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 6));
+
+    h1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+    h2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+    h1 = _mm_add_epi32(h1, _mm_shuffle_epi32(h1, _MM_SHUFFLE(2, 3, 0, 1)));
+    h1 = _mm_add_epi32(h1, _mm_shuffle_epi32(h1, _MM_SHUFFLE(1, 0, 3, 2)));
+    h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(2, 3, 0, 1)));
+    h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(h1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(h2) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+  unsigned s1, s2;
+
+#ifdef LODEPNG_X86_DISPATCH
+  /*loder extension: whole blocks go through the widest SIMD version the CPU supports, the rest below*/
+  if(len >= 64u && __builtin_cpu_supports("avx2")) {
+    adler = update_adler32_avx2(adler, data, len & ~63u);
+    data += len & ~63u;
+    len &= 63u;
+  } else if(len >= 32u && __builtin_cpu_supports("ssse3")) {
+    adler = update_adler32_ssse3(adler, data, len & ~31u);
+    data += len & ~31u;
+    len &= 31u;
+  }
+#endif /*LODEPNG_X86_DISPATCH*/
+
+  s1 = adler & 0xffffu;
+  s2 = (adler >> 16u) & 0xffffu;
+  while(len != 0u) {
+    unsigned i;
+    /*at least 5552 sums can be done before the sums overflow, saving a lot of module divisions*/
+    unsigned amount = len > 5552u ? 5552u : len;
+    len -= amount;
+    for(i = 0; i != amount; ++i) {
+      s1 += (*data++);
+      s2 += s1;
+    }
+    s1 %= 65521u;
+    s2 %= 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+
+/*Return the adler32 of the bytes data[0..len-1]*/
+static unsigned adler32(const unsigned char* data, unsigned len) {
+  return update_adler32(1u, data, len);
+}
+
+/*loder extension: the adler32 of two pieces of data one after the other, given the adler32 of each and
+the length of the second, as with zlib's adler32_combine*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2) {
+  const unsigned base = 65521u;
+  unsigned rem = (unsigned)(len2 % base);
+  unsigned sum1 = adler1 & 0xffffu;
+  unsigned sum2 = (rem * sum1) % base;
+  sum1 += (adler2 & 0xffffu) + base - 1u;
+  sum2 += ((adler1 >> 16u) & 0xffffu) + ((adler2 >> 16u) & 0xffffu) + base - rem;
+  if(sum1 >= base) sum1 -= base;
+  if(sum1 >= base) sum1 -= base;
+  if(sum2 >= 2u * base) sum2 -= 2u * base;
+  if(sum2 >= base) sum2 -= base;
+  return (sum2 << 16u) | sum1;
+}
+
+#ifdef LODEPNG_COMPILE_ENCODER
+/*loder extension: the adler32 of the data, computed in segments by up to the given number of threads*/
+static unsigned adler32_threads(const unsigned char* data, size_t len, unsigned threads) {
+  const size_t segmentsize = 1048576;
+  int numsegments = (int)((len + segmentsize - 1) / segmentsize);
+  unsigned result = 1u;
+  unsigned* sums;
+  int i;
+
+  if(threads <= 1 || numsegments <= 1) return adler32(data, (unsigned)len);
+  sums = (unsigned*)lodepng_malloc(sizeof(unsigned) * (size_t)numsegments);
+  if(!sums) return adler32(data, (unsigned)len);
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(threads)
+#endif
+  for(i = 0; i < numsegments; ++i) {
+    size_t start = (size_t)i * segmentsize;
+    size_t size = len - start > segmentsize ? segmentsize : len - start;
+    sums[i] = adler32(data + start, (unsigned)size);
+  }
+  for(i = 0; i < numsegments; ++i) {
+    size_t start = (size_t)i * segmentsize;
+    result = adler32_combine(result, sums[i], len - start > segmentsize ? segmentsize : len - start);
+  }
+
+  lodepng_free(sums);
+  return result;
+}
+#endif /*LODEPNG_COMPILE_ENCODER*/
+
 #ifdef LODEPNG_COMPILE_DECODER
 
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Inflator (Decompressor)                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-/*get the tree of a deflated block with fixed tree, as specified in the deflate specification
-Returns error code.*/
-static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d) {
-  unsigned error = generateFixedLitLenTree(tree_ll);
-  if(error) return error;
-  return generateFixedDistanceTree(tree_d);
+/*
+loder extension: Huffman blocks are decoded with lookup tables indexed by the next bits of the stream. An
+entry holds everything needed to decode one symbol, or two literals in a row: the number of bits they take,
+the kind of entry, the number of extra bits that follow and a value, which is the literal bytes, the base
+length or distance, or the position of a secondary table for codes longer than the primary table index.
+*/
+#define INFLATE_LITLEN_BITS 11u
+#define INFLATE_DIST_BITS 8u
+/*the largest tables needed for complete codes of up to 15 bits, as computed by zlib's "enough" program*/
+#define INFLATE_LITLEN_ENOUGH 2342u
+#define INFLATE_DIST_ENOUGH 402u
+
+#define ENTRY_LITERAL 0u /*one literal byte*/
+#define ENTRY_LITERALS 1u /*two literal bytes, the first in the low byte of the value*/
+#define ENTRY_BASE 2u /*a length or distance: base value plus extra bits*/
+#define ENTRY_END 3u /*the end code*/
+#define ENTRY_SUBTABLE 4u /*position of a secondary table, whose index has the extra bits field as bit count*/
+#define ENTRY_INVALID 5u /*a code not in the tree, or symbol 286 or 287*/
+#define ENTRY_RESERVED 6u /*distance code 30 or 31*/
+
+#define INFLATE_ENTRY(bits, kind, extra, value)\
+  ((bits) | ((kind) << 8u) | ((extra) << 12u) | ((unsigned)(value) << 16u))
+#define ENTRY_BITS(entry) ((entry) & 255u)
+#define ENTRY_KIND(entry) (((entry) >> 8u) & 15u)
+#define ENTRY_EXTRA(entry) (((entry) >> 12u) & 15u)
+#define ENTRY_VALUE(entry) ((entry) >> 16u)
+
+/*decoding tables of the current block, and those of the fixed codes, built once per stream*/
+typedef struct InflateTables {
+  unsigned litlen[INFLATE_LITLEN_ENOUGH];
+  unsigned dist[INFLATE_DIST_ENOUGH];
+  unsigned fixed_litlen[1u << INFLATE_LITLEN_BITS];
+  unsigned fixed_dist[1u << INFLATE_DIST_BITS];
+  unsigned have_fixed;
+  unsigned bitlen_ll[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned bitlen_d[NUM_DISTANCE_SYMBOLS];
+} InflateTables;
+
+/*the table entry for a symbol, without its code length*/
+static unsigned inflateSymbolEntry(unsigned symbol, unsigned litlen) {
+  if(!litlen) {
+    if(symbol > 29) return INFLATE_ENTRY(0u, ENTRY_RESERVED, 0u, 0u);
+    return INFLATE_ENTRY(0u, ENTRY_BASE, DISTANCEEXTRA[symbol], DISTANCEBASE[symbol]);
+  }
+  if(symbol <= 255) return INFLATE_ENTRY(0u, ENTRY_LITERAL, 0u, symbol);
+  if(symbol == 256) return INFLATE_ENTRY(0u, ENTRY_END, 0u, 0u);
+  if(symbol > LAST_LENGTH_CODE_INDEX) return INFLATE_ENTRY(0u, ENTRY_INVALID, 0u, 0u);
+  return INFLATE_ENTRY(0u, ENTRY_BASE, LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX],
+                       LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX]);
+}
+
+/*Fill the decoding table for the given code lengths, of at most 15 bits, with a primary table indexed by
+tablebits bits followed by any secondary tables, as zlib's inflate_table does. An oversubscribed code, or
+an incomplete one with more than one symbol, is error 55, as for HuffmanTree_makeTable. Codes with a single
+symbol or none leave the rest of the table invalid. For literal/length codes, entries for two short
+literals in a row are then combined*/
+static unsigned inflateMakeTable(unsigned* table, size_t capacity, unsigned tablebits,
+                                 const unsigned* lengths, unsigned numcodes, unsigned litlen) {
+  unsigned count[16], offset[16], sorted[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned i, len, maxlen = 0, numpresent = 0, code = 0, low = (unsigned)(-1), subbase = 0, subbits = 0;
+  unsigned mask = (1u << tablebits) - 1u;
+  size_t next = (size_t)1u << tablebits, left = 1, j;
+
+  for(len = 0; len != 16; ++len) count[len] = 0;
+  for(i = 0; i != numcodes; ++i) ++count[lengths[i]];
+  for(len = 1; len != 16; ++len) {
+    if(count[len]) maxlen = len;
+    numpresent += count[len];
+    left <<= 1u;
+    if(count[len] > left) return 55; /*oversubscribed*/
+    left -= count[len];
+  }
+  if(left != 0 && numpresent >= 2) return 55; /*incomplete*/
+  if(left != 0) {
+    for(j = 0; j != capacity; ++j) table[j] = INFLATE_ENTRY(1u, ENTRY_INVALID, 0u, 0u);
+  }
+
+  /*sort the symbols by code length, which for each length is the order of their canonical codes*/
+  offset[1] = 0;
+  for(len = 1; len != 15; ++len) offset[len + 1] = offset[len] + count[len];
+  for(i = 0; i != numcodes; ++i) {
+    if(lengths[i]) sorted[offset[lengths[i]]++] = i;
+  }
+
+  /*code is the current code with its bits reversed, since the stream gives the first bit of a code first*/
+  for(i = 0; i != numpresent; ++i) {
+    unsigned symbol = sorted[i], incr;
+    unsigned entry = inflateSymbolEntry(symbol, litlen);
+    len = lengths[symbol];
+    if(len <= tablebits) {
+      for(j = code; j <= mask; j += (size_t)1u << len) table[j] = entry | len;
+    } else {
+      if((code & mask) != low) {
+        /*a secondary table for the codes sharing these first bits, large enough for all of them*/
+        unsigned curr = len - tablebits;
+        size_t room = (size_t)1u << curr;
+        while(curr + tablebits < maxlen) {
+          if(room <= count[curr + tablebits]) break;
+          room = (room - count[curr + tablebits]) << 1u;
+          ++curr;
+        }
+        if(next + ((size_t)1u << curr) > capacity) return 55;
+        low = code & mask;
+        subbase = (unsigned)next;
+        subbits = curr;
+        next += (size_t)1u << curr;
+        table[low] = INFLATE_ENTRY(tablebits, ENTRY_SUBTABLE, subbits, subbase);
+      }
+      for(j = code >> tablebits; j < ((size_t)1u << subbits); j += (size_t)1u << (len - tablebits)) {
+        table[subbase + j] = entry | len;
+      }
+    }
+    --count[len];
+    /*increment the reversed code*/
+    incr = 1u << (len - 1u);
+    while(code & incr) incr >>= 1u;
+    code = incr ? (code & (incr - 1u)) + incr : 0u;
+  }
+
+  if(litlen) {
+    /*going down, so that the entry for the bits after the first literal is not yet combined itself*/
+    for(j = mask + 1u; j-- != 0;) {
+      unsigned first = table[j], second, bits = ENTRY_BITS(first);
+      if(ENTRY_KIND(first) != ENTRY_LITERAL || bits >= tablebits) continue;
+      second = table[j >> bits];
+      if(ENTRY_KIND(second) != ENTRY_LITERAL || bits + ENTRY_BITS(second) > tablebits) continue;
+      table[j] = INFLATE_ENTRY(bits + ENTRY_BITS(second), ENTRY_LITERALS, 0u,
+                               ENTRY_VALUE(first) | (ENTRY_VALUE(second) << 8u));
+    }
+  }
+
+  return 0;
 }
 
-/*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      LodePNGBitReader* reader) {
+/*the tables of the fixed codes, as specified in the deflate specification. These are built on first use in each
+stream rather than once into static tables: streams are inflated concurrently by OpenMP threads, and C90 has no
+portable way to guard a lazily filled static table without an init hook, while spelling the 2304 entries out as
+constants would tie them to the entry format above. Building them takes around 10 microseconds.*/
+static unsigned inflateMakeFixedTables(InflateTables* tables) {
+  unsigned i, error;
+  for(i =   0; i <= 143; ++i) tables->bitlen_ll[i] = 8;
+  for(i = 144; i <= 255; ++i) tables->bitlen_ll[i] = 9;
+  for(i = 256; i <= 279; ++i) tables->bitlen_ll[i] = 7;
+  for(i = 280; i <= 287; ++i) tables->bitlen_ll[i] = 8;
+  for(i = 0; i != NUM_DISTANCE_SYMBOLS; ++i) tables->bitlen_d[i] = 5;
+  error = inflateMakeTable(tables->fixed_litlen, 1u << INFLATE_LITLEN_BITS, INFLATE_LITLEN_BITS,
+                           tables->bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 1);
+  if(!error) error = inflateMakeTable(tables->fixed_dist, 1u << INFLATE_DIST_BITS, INFLATE_DIST_BITS,
+                                      tables->bitlen_d, NUM_DISTANCE_SYMBOLS, 0);
+  tables->have_fixed = !error;
+  return error;
+}
+
+/*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree.
+loder extension: the code lengths are returned, from which the caller makes decoding tables*/
+static unsigned getTreeInflateDynamic(unsigned* bitlen_ll, unsigned* bitlen_d, LodePNGBitReader* reader) {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
-  unsigned* bitlen_ll = 0; /*lit,len code lengths*/
-  unsigned* bitlen_d = 0; /*dist code lengths*/
   /*code length code lengths ("clcl"), the bit lengths of the huffman tree used to compress bitlen_ll and bitlen_d*/
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
@@ -1147,9 +1554,6 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
-    bitlen_ll = (unsigned*)lodepng_malloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
-    bitlen_d = (unsigned*)lodepng_malloc(NUM_DISTANCE_SYMBOLS * sizeof(unsigned));
-    if(!bitlen_ll || !bitlen_d) ERROR_BREAK(83 /*alloc fail*/);
     lodepng_memset(bitlen_ll, 0, NUM_DEFLATE_CODE_SYMBOLS * sizeof(*bitlen_ll));
     lodepng_memset(bitlen_d, 0, NUM_DISTANCE_SYMBOLS * sizeof(*bitlen_d));
 
@@ -1219,135 +1623,256 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     if(bitlen_ll[256] == 0) ERROR_BREAK(64); /*the length of the end code 256 must be larger than 0*/
 
-    /*now we've finally got HLIT and HDIST, so generate the code trees, and the function is done*/
-    error = HuffmanTree_makeFromLengths(tree_ll, bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 15);
-    if(error) break;
-    error = HuffmanTree_makeFromLengths(tree_d, bitlen_d, NUM_DISTANCE_SYMBOLS, 15);
-
     break; /*end of error-while*/
   }
 
   lodepng_free(bitlen_cl);
-  lodepng_free(bitlen_ll);
-  lodepng_free(bitlen_d);
   HuffmanTree_cleanup(&tree_cl);
 
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
-static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype, size_t max_output_size) {
-  unsigned error = 0;
-  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
-  HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  const size_t reserved_size = 260; /* must be at least 258 for max length, and a few extra for adding a few extra literals */
-  int done = 0;
-
-  if(!ucvector_reserve(out, out->size + reserved_size)) return 83; /*alloc fail*/
+/*
+loder extension: the bit buffer of inflateHuffmanBlock, a size_t holding bitcount bits not yet used, the
+first in its lowest bit. A refill leaves at least INFLATE_BUFFER_BITS - 8 bits. With at least a word of
+input left, a little-endian CPU loads a whole word at once, which may also put some bits of the next byte
+above bitcount; these are the same bits that will be loaded with that byte, so ORing it in later does no
+harm. At the end of the input, zero bytes are loaded instead, and counted in zeros. At the end of a piece
+of split input, the next is brought into view a byte at a time. Loading bytes stops short of a full buffer,
+so that a word can still be shifted in after it.
+*/
+#define INFLATE_BUFFER_BITS (sizeof(size_t) * 8u)
+
+#if (defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)\
+    || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+#define INFLATE_REFILL_WORD(){\
+  size_t word;\
+  lodepng_memcpy(&word, in, sizeof(word));\
+  bitbuf |= word << bitcount;\
+  in += (INFLATE_BUFFER_BITS - 1u - bitcount) >> 3u;\
+  bitcount |= INFLATE_BUFFER_BITS - 8u;\
+}
+#define INFLATE_CAN_REFILL_WORD() ((size_t)(in_end - in) >= sizeof(size_t))
+#else
+#define INFLATE_REFILL_WORD() {}
+#define INFLATE_CAN_REFILL_WORD() 0
+#endif
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
+#define INFLATE_REFILL(){\
+  if(INFLATE_CAN_REFILL_WORD()) INFLATE_REFILL_WORD()\
+  else {\
+    while(bitcount < INFLATE_BUFFER_BITS - 8u) {\
+      if(in == in_end && reader->base + reader->size < in_limit) {\
+        in = LodePNGBitReader_next(reader);\
+        in_end = reader->data + reader->size;\
+      }\
+      if(in != in_end) bitbuf |= (size_t)(*in++) << bitcount;\
+      else ++zeros;\
+      bitcount += 8u;\
+    }\
+  }\
+}
 
-  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
-  else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
-
-
-  while(!error && !done) /*decode all symbols until end reached, breaks at end code*/ {
-    /*code_ll is literal, length or end code*/
-    unsigned code_ll;
-    /* ensure enough bits for 2 huffman code reads (15 bits each): if the first is a literal, a second literal is read at once. This
-    appears to be slightly faster, than ensuring 20 bits here for 1 huffman symbol and the potential 5 extra bits for the length symbol.*/
-    ensureBits32(reader, 30);
-    code_ll = huffmanDecodeSymbol(reader, &tree_ll);
-    if(code_ll <= 255) {
-      /*slightly faster code path if multiple literals in a row*/
-      out->data[out->size++] = (unsigned char)code_ll;
-      code_ll = huffmanDecodeSymbol(reader, &tree_ll);
-    }
-    if(code_ll <= 255) /*literal symbol*/ {
-      out->data[out->size++] = (unsigned char)code_ll;
-    } else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/ {
-      unsigned code_d, distance;
-      unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, backward, length;
-
-      /*part 1: get length base*/
-      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
-
-      /*part 2: get extra bits and add the value of that to length*/
-      numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if(numextrabits_l != 0) {
-        /* bits already ensured above */
-        ensureBits25(reader, 5);
-        length += readBits(reader, numextrabits_l);
+#define INFLATE_CONSUME(nbits){\
+  bitbuf >>= (nbits);\
+  bitcount -= (nbits);\
+}
+
+/*whether any of the bits used so far were beyond the end of the input*/
+#define INFLATE_OVERRUN()\
+  (zeros && (reader->base + (size_t)(in - reader->data) + zeros) * 8u - bitcount > reader->bitsize)
+
+/*loder extension: the state of progress reporting through a stream, and of the output discarded from the
+start of the buffer with a window size. Sizes compared with the settings count the discarded output too*/
+typedef struct InflateProgress {
+  size_t at; /*the output size at which the progress function is next due, or 0*/
+  size_t discarded; /*the number of bytes discarded*/
+  unsigned adler; /*the Adler32 checksum of the bytes discarded*/
+} InflateProgress;
+
+static void InflateProgress_init(InflateProgress* progress) {
+  progress->at = 0;
+  progress->discarded = 0;
+  progress->adler = 1u;
+}
+
+/*loder extension: call the progress function, which is due, and then with a window size discard all but the
+end of the output, once there is at least as much again to discard, so that the end is never moved over itself*/
+static void inflateReport(ucvector* out, InflateProgress* progress, const LodePNGDecompressSettings* settings) {
+  size_t keep = settings->window_size > 32768u ? settings->window_size : 32768u;
+  progress->at = settings->progress(progress->discarded + out->size, settings->progress_context);
+  if(settings->window_size && out->size / 2u >= keep) {
+    size_t drop = out->size - keep;
+    if(!settings->ignore_adler32) progress->adler = update_adler32(progress->adler, out->data, (unsigned)drop);
+    lodepng_memcpy(out->data, out->data + drop, keep);
+    out->size = keep;
+    progress->discarded += drop;
+  }
+}
+
+/*loder extension: the size of the output buffer at which the maximum size, progress or stopping size must
+next be checked, so that the decoding loop need only compare with this one value*/
+static size_t inflateCheckAt(const LodePNGDecompressSettings* settings, const InflateProgress* progress) {
+  size_t at = (size_t)(-1);
+  if(settings->max_output_size && settings->max_output_size < at) at = settings->max_output_size + 1u;
+  if(settings->stop_output_size && settings->stop_output_size < at) at = settings->stop_output_size;
+  if(progress->at && progress->at < at) at = progress->at;
+  if(at == (size_t)(-1)) return at;
+  return at > progress->discarded ? at - progress->discarded : 0;
+}
+
+/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.
+loder extension: progress is updated as the progress function is called. The
+block is decoded with the given tables, reading from a local bit buffer that is loaded a word at a time
+and copying matches a word at a time while there is room, with byte-wise versions near the ends of the
+input and output. The output grows only if it fills up, so an output reserved to its exact size is not
+reallocated*/
+static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader, unsigned btype,
+                                    const LodePNGDecompressSettings* settings, InflateProgress* progress,
+                                    InflateTables* tables) {
+  unsigned error = 0;
+  size_t max_output_size = settings->max_output_size, stop_output_size = settings->stop_output_size;
+  size_t check_at;
+  const size_t reserved_size = 260; /* must be at least 258 for max length, and a few extra for adding a few extra literals */
+  const unsigned* litlen;
+  const unsigned* dist;
+  const unsigned char* in;
+  const unsigned char* in_end;
+  size_t in_limit = reader->bitsize >> 3u, bitbuf = 0, zeros = 0;
+  unsigned bitcount = 0;
+  unsigned char* data = out->data;
+  size_t size = out->size, allocsize = out->allocsize;
+
+  if(btype == 1) {
+    if(!tables->have_fixed) error = inflateMakeFixedTables(tables);
+    litlen = tables->fixed_litlen;
+    dist = tables->fixed_dist;
+  } else /*if(btype == 2)*/ {
+    error = getTreeInflateDynamic(tables->bitlen_ll, tables->bitlen_d, reader);
+    if(!error) error = inflateMakeTable(tables->litlen, INFLATE_LITLEN_ENOUGH, INFLATE_LITLEN_BITS,
+                                        tables->bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 1);
+    if(!error) error = inflateMakeTable(tables->dist, INFLATE_DIST_ENOUGH, INFLATE_DIST_BITS,
+                                        tables->bitlen_d, NUM_DISTANCE_SYMBOLS, 0);
+    litlen = tables->litlen;
+    dist = tables->dist;
+  }
+  if(error) return error;
+  in = reader->data + LodePNGBitReader_start(reader, 1u);
+  in_end = reader->data + reader->size;
+
+  INFLATE_REFILL();
+  INFLATE_CONSUME(reader->bp & 7u);
+  check_at = inflateCheckAt(settings, progress);
+
+  for(;;) /*decode all symbols until end reached, breaks at end code*/ {
+    unsigned entry, kind;
+    INFLATE_REFILL();
+    entry = litlen[bitbuf & ((1u << INFLATE_LITLEN_BITS) - 1u)];
+    if(ENTRY_KIND(entry) == ENTRY_SUBTABLE) {
+      entry = litlen[ENTRY_VALUE(entry) + ((bitbuf >> INFLATE_LITLEN_BITS) & ((1u << ENTRY_EXTRA(entry)) - 1u))];
+    }
+    INFLATE_CONSUME(ENTRY_BITS(entry));
+    kind = ENTRY_KIND(entry);
+
+    if(kind <= ENTRY_LITERALS) /*one or two literal symbols*/ {
+      if(allocsize - size < 2u && allocsize - size <= kind) {
+        out->size = size;
+        if(!ucvector_reserve(out, size + reserved_size)) ERROR_BREAK(83); /*alloc fail*/
+        data = out->data;
+        allocsize = out->allocsize;
       }
-
-      /*part 3: get distance code*/
-      ensureBits32(reader, 28); /* up to 15 for the huffman symbol, up to 13 for the extra bits */
-      code_d = huffmanDecodeSymbol(reader, &tree_d);
-      if(code_d > 29) {
-        if(code_d <= 31) {
+      data[size] = (unsigned char)ENTRY_VALUE(entry);
+      if(allocsize - size >= 2u) data[size + 1u] = (unsigned char)(ENTRY_VALUE(entry) >> 8u);
+      size += kind + 1u;
+    } else if(kind == ENTRY_BASE) /*length code*/ {
+      unsigned char* dest;
+      const unsigned char* source;
+      size_t length, distance;
+
+      /*get length base, and add the value of the extra bits*/
+      length = ENTRY_VALUE(entry) + ((unsigned)bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1u));
+      INFLATE_CONSUME(ENTRY_EXTRA(entry));
+
+      /*get distance code: a 64-bit buffer still holds enough bits for it and its extra bits*/
+      if(INFLATE_BUFFER_BITS < 64u) INFLATE_REFILL();
+      entry = dist[bitbuf & ((1u << INFLATE_DIST_BITS) - 1u)];
+      if(ENTRY_KIND(entry) == ENTRY_SUBTABLE) {
+        entry = dist[ENTRY_VALUE(entry) + ((bitbuf >> INFLATE_DIST_BITS) & ((1u << ENTRY_EXTRA(entry)) - 1u))];
+      }
+      INFLATE_CONSUME(ENTRY_BITS(entry));
+      if(ENTRY_KIND(entry) != ENTRY_BASE) {
+        if(ENTRY_KIND(entry) == ENTRY_RESERVED) {
           ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
-        } else /* if(code_d == INVALIDSYMBOL) */{
+        } else /*if(ENTRY_KIND(entry) == ENTRY_INVALID)*/ {
           ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
         }
       }
-      distance = DISTANCEBASE[code_d];
-
-      /*part 4: get extra bits from distance*/
-      numextrabits_d = DISTANCEEXTRA[code_d];
-      if(numextrabits_d != 0) {
-        /* bits already ensured above */
-        distance += readBits(reader, numextrabits_d);
+      if(INFLATE_BUFFER_BITS < 64u) INFLATE_REFILL();
+      distance = ENTRY_VALUE(entry) + ((unsigned)bitbuf & ((1u << ENTRY_EXTRA(entry)) - 1u));
+      INFLATE_CONSUME(ENTRY_EXTRA(entry));
+
+      /*fill in all the out[n] values based on the length and dist*/
+      if(distance > size) ERROR_BREAK(52); /*too long backward distance*/
+      if(allocsize - size < length) {
+        out->size = size;
+        if(!ucvector_reserve(out, size + reserved_size)) ERROR_BREAK(83); /*alloc fail*/
+        data = out->data;
+        allocsize = out->allocsize;
       }
-
-      /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = out->size;
-      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
-
-      out->size += length;
-      if(distance < length) {
-        size_t forward;
-        lodepng_memcpy(out->data + start, out->data + backward, distance);
-        start += distance;
-        for(forward = distance; forward < length; ++forward) {
-          out->data[start++] = out->data[backward++];
-        }
+      dest = data + size;
+      source = dest - distance;
+      if(distance >= sizeof(size_t) && allocsize - size >= length + sizeof(size_t)) {
+        /*whole words, overrunning the end by up to a word less one byte; each word is read from output
+        that is already complete, since the distance is at least a word*/
+        const unsigned char* end = dest + length;
+        do {
+          size_t word;
+          lodepng_memcpy(&word, source, sizeof(word));
+          lodepng_memcpy(dest, &word, sizeof(word));
+          source += sizeof(word);
+          dest += sizeof(word);
+        } while(dest < end);
+      } else if(distance == 1) {
+        lodepng_memset(dest, *source, length);
       } else {
-        lodepng_memcpy(out->data + start, out->data + backward, length);
+        size_t i;
+        for(i = 0; i != length; ++i) dest[i] = source[i];
       }
-    } else if(code_ll == 256) {
-      done = 1; /*end code, finish the loop*/
-    } else /*if(code_ll == INVALIDSYMBOL)*/ {
+      size += length;
+    } else if(kind == ENTRY_END) {
+      if(INFLATE_OVERRUN()) error = 51; /*error, bit pointer jumps past memory*/
+      break; /*end code, finish the loop*/
+    } else /*if(kind == ENTRY_INVALID)*/ {
       ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
     }
-    if(out->allocsize - out->size < reserved_size) {
-      if(!ucvector_reserve(out, out->size + reserved_size)) ERROR_BREAK(83); /*alloc fail*/
-    }
-    /*check if any of the ensureBits above went out of bounds*/
-    if(reader->bp > reader->bitsize) {
-      /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-      (10=no endcode, 11=wrong jump outside of tree)*/
-      /* TODO: revise error codes 10,11,50: the above comment is no longer valid */
-      ERROR_BREAK(51); /*error, bit pointer jumps past memory*/
-    }
-    if(max_output_size && out->size > max_output_size) {
-      ERROR_BREAK(109); /*error, larger than max size*/
+    /*check if any of the bits used were beyond the end of the input*/
+    if(INFLATE_OVERRUN()) ERROR_BREAK(51); /*error, bit pointer jumps past memory*/
+    if(size >= check_at) {
+      size_t total = progress->discarded + size;
+      out->size = size;
+      if(max_output_size && total > max_output_size) {
+        ERROR_BREAK(109); /*error, larger than max size*/
+      }
+      if(progress->at && total >= progress->at) {
+        inflateReport(out, progress, settings);
+        size = out->size; /*the window of output may have moved to the start of the buffer*/
+      }
+      if(stop_output_size && total >= stop_output_size) break; /*enough output, stop early*/
+      check_at = inflateCheckAt(settings, progress);
     }
   }
 
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
+  out->size = size;
+  reader->bp = (reader->base + (size_t)(in - reader->data) + zeros) * 8u - bitcount;
 
   return error;
 }
 
 static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
-                                     const LodePNGDecompressSettings* settings) {
+                                     const LodePNGDecompressSettings* settings, size_t discarded) {
   size_t bytepos;
-  size_t size = reader->size;
+  size_t size = reader->bitsize >> 3u;
+  unsigned char header[4];
   unsigned LEN, NLEN, error = 0;
 
   /*go to first boundary of byte*/
@@ -1355,14 +1880,18 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(bytepos + 4 >= size) return 52; /*error, bit pointer will jump past memory*/
-  LEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
-  NLEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
+  pieces_copy(header, reader->pieces, reader->numpieces, bytepos, 4u);
+  LEN = (unsigned)header[0] + ((unsigned)header[1] << 8u);
+  NLEN = (unsigned)header[2] + ((unsigned)header[3] << 8u);
+  bytepos += 4;
 
   /*check if 16-bit NLEN is really the one's complement of LEN*/
   if(!settings->ignore_nlen && LEN + NLEN != 65535) {
     return 21; /*error: NLEN is not one's complement of LEN*/
   }
 
+  /*loder extension: fail before growing the buffer beyond the maximum, which may have been reserved*/
+  if(settings->max_output_size && discarded + out->size + LEN > settings->max_output_size) return 109;
   if(!ucvector_resize(out, out->size + LEN)) return 83; /*alloc fail*/
 
   /*read the literal data: LEN bytes are now stored in the out buffer*/
@@ -1370,7 +1899,7 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
 
   /*out->data can be NULL (when LEN is zero), and arithmetics on NULL ptr is undefined*/
   if (LEN) {
-    lodepng_memcpy(out->data + out->size - LEN, reader->data + bytepos, LEN);
+    pieces_copy(out->data + out->size - LEN, reader->pieces, reader->numpieces, bytepos, LEN);
     bytepos += LEN;
   }
 
@@ -1379,29 +1908,89 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
   return error;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings) {
+/*loder extension: inflate the deflate stream from byte start to byte end of input held in pieces. The
+progress state is initialised here, and tells the caller how much output was discarded, if any*/
+static unsigned inflatePieces(ucvector* out, const LodePNGPiece* pieces, size_t numpieces, size_t start, size_t end,
+                              const LodePNGDecompressSettings* settings, InflateProgress* progress) {
   unsigned BFINAL = 0;
   LodePNGBitReader reader;
-  unsigned error = LodePNGBitReader_init(&reader, in, insize);
+  unsigned error = LodePNGBitReader_init(&reader, pieces, numpieces, start, end);
+  InflateTables* tables;
 
+  InflateProgress_init(progress);
   if(error) return error;
+  tables = (InflateTables*)lodepng_malloc(sizeof(InflateTables));
+  if(!tables) return 83; /*alloc fail*/
+  tables->have_fixed = 0;
+  if(settings->progress) progress->at = settings->progress(out->size, settings->progress_context);
 
   while(!BFINAL) {
     unsigned BTYPE;
-    if(reader.bitsize - reader.bp < 3) return 52; /*error, bit pointer will jump past memory*/
+    size_t total;
+    if(reader.bitsize - reader.bp < 3) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
     ensureBits9(&reader, 3);
     BFINAL = readBits(&reader, 1);
     BTYPE = readBits(&reader, 2);
 
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings); /*no compression*/
-    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size); /*compression, BTYPE 01 or 10*/
-    if(!error && settings->max_output_size && out->size > settings->max_output_size) error = 109;
+    if(BTYPE == 3) ERROR_BREAK(20); /*error: invalid BTYPE*/
+    if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings, progress->discarded); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings, progress, tables); /*BTYPE 01 or 10*/
+    total = progress->discarded + out->size;
+    if(!error && settings->max_output_size && total > settings->max_output_size) error = 109;
     if(error) break;
+    if(progress->at && total >= progress->at) inflateReport(out, progress, settings);
+    if(settings->stop_output_size && total >= settings->stop_output_size) break; /*enough output*/
   }
 
+  lodepng_free(tables);
+  return error;
+}
+
+static unsigned lodepng_inflatev(ucvector* out,
+                                 const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings) {
+  LodePNGPiece piece;
+  InflateProgress progress;
+  piece.data = in;
+  piece.size = insize;
+  piece.offset = 0;
+  return inflatePieces(out, &piece, 1, 0, insize, settings, &progress);
+}
+
+/*loder extension: inflate one segment of a stream written with restart points, which starts at byte start
+of the input and must decompress to exactly size bytes. The last segment ends with the final block; any
+other must not contain the final block, and ends with an empty stored block whose last byte is at end - 1.
+The input may continue beyond the segment, up to byte insize*/
+static unsigned inflateSegment(ucvector* out, const LodePNGPiece* pieces, size_t numpieces, size_t start,
+                               size_t end, size_t insize, size_t size, unsigned final,
+                               const LodePNGDecompressSettings* settings) {
+  LodePNGBitReader reader;
+  InflateProgress progress;
+  unsigned error = LodePNGBitReader_init(&reader, pieces, numpieces, start, insize);
+  InflateTables* tables = (InflateTables*)lodepng_malloc(sizeof(InflateTables));
+  if(!tables) return 83; /*alloc fail*/
+  tables->have_fixed = 0;
+  InflateProgress_init(&progress);
+
+  while(!error) {
+    unsigned BFINAL, BTYPE;
+    size_t before = out->size;
+    if(reader.bitsize - reader.bp < 3) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+    ensureBits9(&reader, 3);
+    BFINAL = readBits(&reader, 1);
+    BTYPE = readBits(&reader, 2);
+
+    if(BTYPE == 3) ERROR_BREAK(20); /*error: invalid BTYPE*/
+    if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings, 0);
+    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings, &progress, tables);
+    if(error) break;
+    if(BFINAL) error = final && out->size == size ? 0 : 1;
+    else if(!final && BTYPE == 0 && before == size) error = (reader.bp + 7u) / 8u == end ? 0 : 1;
+    else continue;
+    break;
+  }
+
+  lodepng_free(tables);
   return error;
 }
 
@@ -1499,8 +2088,9 @@ typedef struct Hash {
   unsigned short* zeros; /*length of zeros streak, used as a second hash chain*/
 } Hash;
 
+static void hash_reset(Hash* hash, unsigned windowsize, size_t used);
+
 static unsigned hash_init(Hash* hash, unsigned windowsize) {
-  unsigned i;
   hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
   hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
   hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
@@ -1513,15 +2103,30 @@ static unsigned hash_init(Hash* hash, unsigned windowsize) {
     return 83; /*alloc fail*/
   }
 
-  /*initialize hash table*/
-  for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->val[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chain[i] = i; /*same value as index indicates uninitialized*/
+  hash_reset(hash, windowsize, windowsize);
+  return 0;
+}
 
+/*loder extension: return the tables of a hash to their initial state, given that at most the first
+'used' positions of the window have been filled since then. If that is fewer than the window size, no
+position has been overwritten, so every chain that was started has one of their hash values as its
+head, and only those need be reset*/
+static void hash_reset(Hash* hash, unsigned windowsize, size_t used) {
+  unsigned i;
+  if(used < windowsize) {
+    for(i = 0; i != used; ++i) {
+      if(hash->val[i] >= 0) hash->head[hash->val[i]] = -1;
+      hash->val[i] = -1;
+      hash->chain[i] = i;
+      hash->chainz[i] = i;
+    }
+  } else {
+    for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
+    for(i = 0; i != windowsize; ++i) hash->val[i] = -1;
+    for(i = 0; i != windowsize; ++i) hash->chain[i] = i; /*same value as index indicates uninitialized*/
+    for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
+  }
   for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i) hash->headz[i] = -1;
-  for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
-
-  return 0;
 }
 
 static void hash_cleanup(Hash* hash) {
@@ -1534,6 +2139,32 @@ static void hash_cleanup(Hash* hash) {
   lodepng_free(hash->chainz);
 }
 
+/*loder extension: get the hash tables kept in a workspace ready for encoding insize bytes, allocating
+them only if there are none yet for this window size*/
+static unsigned workspace_hash(LodePNGWorkspace* workspace, unsigned windowsize, size_t insize, Hash** hash) {
+  if(workspace->hash && workspace->hash_windowsize == windowsize) {
+    hash_reset(workspace->hash, windowsize, workspace->hash_used);
+  } else {
+    if(workspace->hash) {
+      hash_cleanup(workspace->hash);
+      lodepng_free(workspace->hash);
+    }
+    workspace->hash_windowsize = 0;
+    workspace->hash = (Hash*)lodepng_malloc(sizeof(Hash));
+    if(!workspace->hash) return 83; /*alloc fail*/
+    if(hash_init(workspace->hash, windowsize)) {
+      hash_cleanup(workspace->hash);
+      lodepng_free(workspace->hash);
+      workspace->hash = 0;
+      return 83; /*alloc fail*/
+    }
+    workspace->hash_windowsize = windowsize;
+  }
+  workspace->hash_used = insize;
+  *hash = workspace->hash;
+  return 0;
+}
+
 
 
 static unsigned getHash(const unsigned char* data, size_t size, size_t pos) {
@@ -1576,6 +2207,23 @@ static void updateHashChain(Hash* hash, size_t wpos, unsigned hashval, unsigned
   hash->headz[numzeros] = (int)wpos;
 }
 
+/*loder extension: add the data from start to end to a hash, as though it had just been encoded, so that
+the data following it can refer back to it*/
+static void hash_prime(Hash* hash, const unsigned char* in, size_t start, size_t end, unsigned windowsize) {
+  size_t pos;
+  unsigned numzeros = 0;
+  for(pos = start; pos < end; ++pos) {
+    unsigned hashval = getHash(in, end, pos);
+    if(hashval == 0) {
+      if(numzeros == 0) numzeros = countZeros(in, end, pos);
+      else if(pos + numzeros > end || in[pos + numzeros - 1] != 0) --numzeros;
+    } else {
+      numzeros = 0;
+    }
+    updateHashChain(hash, pos & (windowsize - 1), hashval, numzeros);
+  }
+}
+
 /*
 LZ77-encode the data. Return value is error code. The input are raw bytes, the output
 is in the form of unsigned integers with codes representing for example literal bytes, or
@@ -1736,7 +2384,12 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize) {
+/*loder extension: called after each complete deflate block when streaming, with the number of
+whole bytes in out. It must remove those bytes from out, leaving any partial byte in place*/
+typedef unsigned (*DeflateFlush)(ucvector* out, size_t complete, void* context);
+
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize,
+                                     unsigned final, DeflateFlush flush, void* flush_context) {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
 
@@ -1747,7 +2400,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned char firstbyte;
     size_t pos = out->size;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     LEN = 65535;
@@ -1764,6 +2417,12 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     out->data[pos + 4] = (unsigned char)(NLEN >> 8u);
     lodepng_memcpy(out->data + pos + 5, data + datapos, LEN);
     datapos += LEN;
+
+    /*stored blocks always end on a byte boundary*/
+    if(flush && i != numdeflateblocks - 1) {
+      unsigned error = flush(out, out->size, flush_context);
+      if(error) return error;
+    }
   }
 
   return 0;
@@ -2066,18 +2725,144 @@ static unsigned deflateFixed(LodePNGBitWriter* writer, Hash* hash,
   return error;
 }
 
+/*loder extension: compress the input from start to end as a series of blocks, independently of the
+data before it except that matches may refer back to it, if prime is set. Unless this is the end of the
+input, the blocks are followed by an empty stored block, so that the output ends on a byte boundary and
+the output for the next segment can simply be appended to it*/
+static unsigned deflateSegment(ucvector* out, const unsigned char* in, size_t start, size_t end,
+                               size_t insize, size_t blocksize, const LodePNGCompressSettings* settings,
+                               unsigned prime) {
+  unsigned error;
+  size_t pos;
+  Hash hash;
+  LodePNGBitWriter writer;
+
+  if(settings->btype == 0) {
+    /*stored blocks end on a byte boundary, so the empty block can simply follow them*/
+    error = deflateNoCompression(out, in + start, end - start, end == insize, NULL, NULL);
+    if(!error && end != insize) {
+      if(!ucvector_resize(out, out->size + 5)) error = 83; /*alloc fail*/
+      else lodepng_memcpy(out->data + out->size - 5, "\0\0\0\377\377", 5); /*BFINAL 0, BTYPE 00, LEN 0 and NLEN*/
+    }
+    return error;
+  }
+
+  LodePNGBitWriter_init(&writer, out);
+  error = hash_init(&hash, settings->windowsize);
+  if(!error && prime) hash_prime(&hash, in, start > settings->windowsize ? start - settings->windowsize : 0,
+                                 start, settings->windowsize);
+
+  for(pos = start; pos < end && !error; pos += blocksize) {
+    size_t blockend = end - pos > blocksize ? pos + blocksize : end;
+    unsigned final = (blockend == insize);
+    if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, pos, blockend, settings, final);
+    else error = deflateDynamic(&writer, &hash, in, pos, blockend, settings, final);
+  }
+
+  if(!error && end != insize) {
+    writeBits(&writer, 0, 3); /*BFINAL 0, BTYPE 00, with the rest of the byte left as padding*/
+    if(!ucvector_resize(out, out->size + 4)) error = 83; /*alloc fail*/
+    else lodepng_memcpy(out->data + out->size - 4, "\0\0\377\377", 4); /*LEN 0 and NLEN*/
+  }
+
+  hash_cleanup(&hash);
+  return error;
+}
+
+/*loder extension: the restart points of a stream compressed in independent segments. For each segment
+after the first, the entries hold its 8-byte offset from the start of the zlib stream and the Adler-32
+of all the data before it, both big endian*/
+typedef struct RestartIndex {
+  ucvector entries;
+  unsigned adler; /*of the data compressed so far*/
+} RestartIndex;
+
+static unsigned addRestartPoint(RestartIndex* index, size_t offset) {
+  size_t pos = index->entries.size;
+  if(!ucvector_resize(&index->entries, pos + 12)) return 83; /*alloc fail*/
+  lodepng_set32bitInt(&index->entries.data[pos], (unsigned)((offset >> 16u) >> 16u));
+  lodepng_set32bitInt(&index->entries.data[pos + 4], (unsigned)(offset & 0xffffffffu));
+  lodepng_set32bitInt(&index->entries.data[pos + 8], index->adler);
+  return 0;
+}
+
+/*loder extension: compress segments of the given size concurrently, pigz-style, a round of one segment
+per thread at a time. Segments are appended to out in order, and passed on to flush after each round.
+Without an index, each segment is primed with the data before it; with one, the segments are independent,
+so that decompression can start afresh at the start of any of them, and their offsets are recorded in the
+index. Offsets count from the start of out, including anything flushed*/
+static unsigned deflateSegments(ucvector* out, const unsigned char* in, size_t insize,
+                                size_t segmentsize, size_t blocksize,
+                                const LodePNGCompressSettings* settings, RestartIndex* index,
+                                DeflateFlush flush, void* flush_context) {
+  unsigned error = 0;
+  const unsigned threads = settings->threads ? settings->threads : 1;
+  const size_t numsegments = (insize + segmentsize - 1) / segmentsize;
+  size_t first, flushed = 0;
+  unsigned i;
+  ucvector* segments = (ucvector*)lodepng_malloc(sizeof(ucvector) * threads);
+  unsigned* errors = (unsigned*)lodepng_malloc(sizeof(unsigned) * threads);
+  unsigned* adlers = (unsigned*)lodepng_malloc(sizeof(unsigned) * threads);
+
+  if(!segments || !errors || !adlers) error = 83; /*alloc fail*/
+  for(i = 0; segments && i != threads; ++i) segments[i] = ucvector_init(NULL, 0);
+
+  for(first = 0; first < numsegments && !error; first += threads) {
+    int count = (int)(numsegments - first < threads ? numsegments - first : threads);
+    int j;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+    for(j = 0; j < count; ++j) {
+      size_t start = (first + (size_t)j) * segmentsize;
+      size_t end = insize - start > segmentsize ? start + segmentsize : insize;
+      segments[j].size = 0;
+      errors[j] = deflateSegment(&segments[j], in, start, end, insize, blocksize, settings, !index);
+      if(index) adlers[j] = adler32(in + start, (unsigned)(end - start));
+    }
+
+    for(j = 0; j < count && !error; ++j) {
+      size_t pos = out->size;
+      error = errors[j];
+      if(!error && index) {
+        size_t start = (first + (size_t)j) * segmentsize;
+        if(start > 0) error = addRestartPoint(index, flushed + pos);
+        index->adler = adler32_combine(index->adler, adlers[j],
+                                       insize - start > segmentsize ? segmentsize : insize - start);
+      }
+      if(!error && !ucvector_resize(out, out->size + segments[j].size)) error = 83; /*alloc fail*/
+      if(!error) lodepng_memcpy(out->data + pos, segments[j].data, segments[j].size);
+    }
+    /*everything but the final block ends on a byte boundary*/
+    if(!error && flush && first + (size_t)count < numsegments) {
+      flushed += out->size;
+      error = flush(out, out->size, flush_context);
+    }
+  }
+
+  if(segments) {
+    for(i = 0; i != threads; ++i) lodepng_free(segments[i].data);
+  }
+  lodepng_free(segments);
+  lodepng_free(errors);
+  lodepng_free(adlers);
+  return error;
+}
+
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings) {
+                                 const LodePNGCompressSettings* settings,
+                                 DeflateFlush flush, void* flush_context) {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
-  Hash hash;
+  Hash local_hash;
+  Hash* hash = &local_hash;
   LodePNGBitWriter writer;
 
   LodePNGBitWriter_init(&writer, out);
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, 1, flush, flush_context);
+  else if(settings->btype == 1) blocksize = flush ? 262144 : insize; /*bounded blocks when streaming*/
   else /*if(settings->btype == 2)*/ {
     /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
     blocksize = insize / 8u + 8;
@@ -2085,10 +2870,20 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     if(blocksize > 262144) blocksize = 262144;
   }
 
+  /*loder extension: inputs of more than one segment can be compressed concurrently*/
+  if(settings->threads > 1) {
+    size_t segmentblocksize = settings->btype == 1 ? 262144 : blocksize;
+    if(insize > 4 * segmentblocksize) {
+      return deflateSegments(out, in, insize, 4 * segmentblocksize, segmentblocksize, settings, NULL,
+                             flush, flush_context);
+    }
+  }
+
   numdeflateblocks = (insize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
+  if(settings->workspace) error = workspace_hash(settings->workspace, settings->windowsize, insize, &hash);
+  else error = hash_init(hash, settings->windowsize);
 
   if(!error) {
     for(i = 0; i != numdeflateblocks && !error; ++i) {
@@ -2097,12 +2892,15 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
       size_t end = start + blocksize;
       if(end > insize) end = insize;
 
-      if(settings->btype == 1) error = deflateFixed(&writer, &hash, in, start, end, settings, final);
-      else if(settings->btype == 2) error = deflateDynamic(&writer, &hash, in, start, end, settings, final);
+      if(settings->btype == 1) error = deflateFixed(&writer, hash, in, start, end, settings, final);
+      else if(settings->btype == 2) error = deflateDynamic(&writer, hash, in, start, end, settings, final);
+
+      /*pass on all whole bytes, keeping a partially written last byte for the next block*/
+      if(!error && flush && !final) error = flush(out, out->size - ((writer.bp & 7u) ? 1 : 0), flush_context);
     }
   }
 
-  hash_cleanup(&hash);
+  if(!settings->workspace) hash_cleanup(hash);
 
   return error;
 }
@@ -2111,7 +2909,7 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
-  unsigned error = lodepng_deflatev(&v, in, insize, settings);
+  unsigned error = lodepng_deflatev(&v, in, insize, settings, NULL, NULL);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -2131,45 +2929,14 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
-/* ////////////////////////////////////////////////////////////////////////// */
-/* / Adler32                                                                / */
-/* ////////////////////////////////////////////////////////////////////////// */
-
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
-  unsigned s1 = adler & 0xffffu;
-  unsigned s2 = (adler >> 16u) & 0xffffu;
-
-  while(len != 0u) {
-    unsigned i;
-    /*at least 5552 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5552u ? 5552u : len;
-    len -= amount;
-    for(i = 0; i != amount; ++i) {
-      s1 += (*data++);
-      s2 += s1;
-    }
-    s1 %= 65521u;
-    s2 %= 65521u;
-  }
-
-  return (s2 << 16u) | s1;
-}
-
-/*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len) {
-  return update_adler32(1u, data, len);
-}
-
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-static unsigned lodepng_zlib_decompressv(ucvector* out,
-                                         const unsigned char* in, size_t insize,
-                                         const LodePNGDecompressSettings* settings) {
-  unsigned error = 0;
+/*check the 2-byte zlib header, returning the error code if it isn't one PNG allows*/
+static unsigned readZlibHeader(const unsigned char* in, size_t insize) {
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2194,19 +2961,52 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
       "The additional flags shall not specify a preset dictionary."*/
     return 26;
   }
+  return 0;
+}
+
+/*loder extension: decompress a zlib stream held in pieces, which are read in place. A custom inflate
+function is given the deflate data directly, so they must then be in a single piece. With a window size,
+the number of bytes discarded from the start of the output is stored in discarded, if not NULL*/
+static unsigned zlibDecompressPieces(ucvector* out, size_t* discarded, const LodePNGPiece* pieces, size_t numpieces,
+                                     const LodePNGDecompressSettings* settings) {
+  size_t insize = pieces[numpieces - 1u].offset + pieces[numpieces - 1u].size;
+  unsigned char bytes[4];
+  unsigned error;
+  InflateProgress progress;
 
-  error = inflatev(out, in + 2, insize - 2, settings);
+  InflateProgress_init(&progress);
+  pieces_copy(bytes, pieces, numpieces, 0, LODEPNG_MIN(insize, 2u));
+  error = readZlibHeader(bytes, insize);
+  if(!error) {
+    if(settings->custom_inflate && numpieces == 1) error = inflatev(out, pieces[0].data + 2, insize - 2, settings);
+    else error = inflatePieces(out, pieces, numpieces, 2, insize, settings, &progress);
+  }
+  if(discarded) *discarded = progress.discarded;
   if(error) return error;
 
+  /*the checksum covers the whole stream, so can't be checked if decompression stopped early*/
+  if(settings->stop_output_size && progress.discarded + out->size >= settings->stop_output_size) return 0;
+
   if(!settings->ignore_adler32) {
-    unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(out->data, (unsigned)(out->size));
+    unsigned ADLER32, checksum;
+    pieces_copy(bytes, pieces, numpieces, insize - 4u, 4u);
+    ADLER32 = lodepng_read32bitInt(bytes);
+    checksum = update_adler32(progress.adler, out->data, (unsigned)(out->size));
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
   return 0; /*no error*/
 }
 
+static unsigned lodepng_zlib_decompressv(ucvector* out,
+                                         const unsigned char* in, size_t insize,
+                                         const LodePNGDecompressSettings* settings) {
+  LodePNGPiece piece;
+  piece.data = in;
+  piece.size = insize;
+  piece.offset = 0;
+  return zlibDecompressPieces(out, NULL, &piece, 1, settings);
+}
 
 unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                  size_t insize, const LodePNGDecompressSettings* settings) {
@@ -2243,6 +3043,105 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, size_t exp
   return error;
 }
 
+/*loder extension: decompress a zlib stream written in independent segments of whole scanlines, as indexed
+by a loIX chunk, sharing the segments among threads. Only the segments holding the first expected_size
+bytes are decompressed, and out is left holding exactly that many. A nonzero return value means that the
+index does not fit the stream, or some segment is not as it says, and the stream should be decompressed
+in the usual way instead. The stream is held in pieces, which are read in place*/
+static unsigned inflateIndexed(ucvector* out, const LodePNGPiece* pieces, size_t numpieces,
+                               const unsigned char* index, size_t indexsize, size_t linesize, unsigned h,
+                               size_t expected_size, const LodePNGDecompressSettings* settings,
+                               unsigned threads) {
+  unsigned error = 0, segmentrows, adler = 1u;
+  size_t numsegments, needed, segmentsize, total = linesize * h, i;
+  size_t insize = pieces[numpieces - 1u].offset + pieces[numpieces - 1u].size;
+  size_t* offsets;
+  unsigned* sums;
+  unsigned* errors;
+  unsigned char header[2], trailer[4];
+  int j;
+
+  (void)threads;
+  if(indexsize < 4 || (indexsize - 4) % 12 != 0 || insize < 6) return 1;
+  pieces_copy(header, pieces, numpieces, 0, 2u);
+  pieces_copy(trailer, pieces, numpieces, insize - 4u, 4u);
+  if(readZlibHeader(header, insize)) return 1;
+  segmentrows = lodepng_read32bitInt(index);
+  if(segmentrows == 0 || expected_size == 0 || expected_size > total) return 1;
+  numsegments = (h - 1u) / segmentrows + 1u;
+  segmentsize = linesize * segmentrows;
+  if((indexsize - 4) / 12 != numsegments - 1 || segmentsize / segmentrows != linesize) return 1;
+  needed = (expected_size - 1u) / segmentsize + 1u;
+
+  offsets = (size_t*)lodepng_malloc(sizeof(size_t) * (numsegments + 1));
+  sums = (unsigned*)lodepng_malloc(sizeof(unsigned) * needed);
+  errors = (unsigned*)lodepng_malloc(sizeof(unsigned) * needed);
+  if(!offsets || !sums || !errors || !ucvector_resize(out, expected_size)) error = 83; /*alloc fail*/
+
+  /*the segments start after the 2-byte header, in order, and the last ends before the Adler-32*/
+  if(!error) {
+    offsets[0] = 2;
+    offsets[numsegments] = insize - 4;
+  }
+  for(i = 1; i < numsegments && !error; ++i) {
+    unsigned high = lodepng_read32bitInt(&index[4 + 12 * (i - 1)]);
+    if(high != 0 && sizeof(size_t) <= 4) error = 1;
+    offsets[i] = (((size_t)high << 16u) << 16u) | lodepng_read32bitInt(&index[4 + 12 * (i - 1) + 4]);
+    if(offsets[i] <= offsets[i - 1] || offsets[i] >= insize - 4) error = 1;
+  }
+
+  if(!error) {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(threads ? threads : 1)
+#endif
+    for(j = 0; j < (int)needed; ++j) {
+      size_t start = (size_t)j * segmentsize;
+      size_t full = total - start > segmentsize ? segmentsize : total - start;
+      size_t size = expected_size - start > segmentsize ? segmentsize : expected_size - start;
+      LodePNGDecompressSettings segmentsettings = *settings;
+      ucvector v = ucvector_init(NULL, 0);
+      InflateProgress progress;
+      segmentsettings.max_output_size = full;
+      segmentsettings.stop_output_size = 0;
+      segmentsettings.progress = 0;
+      segmentsettings.window_size = 0;
+      if(!ucvector_reserve(&v, full)) {
+        errors[j] = 83; /*alloc fail*/
+      } else if(size == full) {
+        errors[j] = inflateSegment(&v, pieces, numpieces, offsets[j], offsets[j + 1], insize, full,
+                                   (size_t)j + 1 == numsegments, &segmentsettings);
+      } else {
+        /*the last segment wanted need only be decompressed as far as the rows wanted*/
+        segmentsettings.stop_output_size = size;
+        errors[j] = inflatePieces(&v, pieces, numpieces, offsets[j], offsets[j + 1], &segmentsettings, &progress);
+        if(!errors[j] && v.size < size) errors[j] = 1;
+      }
+      if(!errors[j]) {
+        lodepng_memcpy(out->data + start, v.data, size);
+        if(size == full) sums[j] = adler32(v.data, (unsigned)full);
+      }
+      lodepng_free(v.data);
+    }
+    for(i = 0; i < needed && !error; ++i) error = errors[i];
+  }
+
+  /*the Adler-32 of the data before each segment, and of the whole, are checked if decompressed in full*/
+  for(i = 0; i < needed && !error && !settings->ignore_adler32; ++i) {
+    size_t start = i * segmentsize;
+    size_t full = total - start > segmentsize ? segmentsize : total - start;
+    if(i > 0 && adler != lodepng_read32bitInt(&index[4 + 12 * (i - 1) + 8])) error = 1;
+    if(expected_size - start < full) break;
+    adler = adler32_combine(adler, sums[i], full);
+    if(i + 1 < numsegments && i + 1 == needed && adler != lodepng_read32bitInt(&index[4 + 12 * i + 8])) error = 1;
+    if(i + 1 == numsegments && adler != lodepng_read32bitInt(trailer)) error = 1;
+  }
+
+  lodepng_free(offsets);
+  lodepng_free(sums);
+  lodepng_free(errors);
+  return error;
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2265,7 +3164,7 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   }
 
   if(!error) {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
+    unsigned ADLER32 = adler32_threads(in, insize, settings->threads);
     /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
     unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
     unsigned FLEVEL = 0;
@@ -2318,6 +3217,27 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
 
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
+LodePNGWorkspace* lodepng_workspace_new(void) {
+  LodePNGWorkspace* workspace = (LodePNGWorkspace*)lodepng_malloc(sizeof(LodePNGWorkspace));
+  if(workspace) {
+    workspace->hash = 0;
+    workspace->hash_windowsize = 0;
+    workspace->hash_used = 0;
+    workspace->scanlines = ucvector_init(NULL, 0);
+  }
+  return workspace;
+}
+
+void lodepng_workspace_free(LodePNGWorkspace* workspace) {
+  if(!workspace) return;
+#if defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_ENCODER)
+  if(workspace->hash) hash_cleanup(workspace->hash);
+#endif /*LODEPNG_COMPILE_ZLIB && LODEPNG_COMPILE_ENCODER*/
+  lodepng_free(workspace->hash);
+  lodepng_free(workspace->scanlines.data);
+  lodepng_free(workspace);
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2337,9 +3257,11 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings) {
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
+  settings->workspace = 0;
+  settings->threads = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2354,9 +3276,13 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings) {
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+  settings->stop_output_size = 0;
+  settings->progress = 0;
+  settings->progress_context = 0;
+  settings->window_size = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2375,7 +3301,7 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 #ifdef LODEPNG_COMPILE_CRC
 /* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
+static const unsigned lodepng_crc32_table0[256] = {
            0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
    249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
    498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
@@ -2410,12 +3336,349 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
+static const unsigned lodepng_crc32_table1[256] = {
+           0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+  3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+  1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+  2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+  2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+  1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+  3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+   396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+  4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+   950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+  3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+  1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+  1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+  2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+   792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+  3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+   998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+  4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+  1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+  3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+  2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+  1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+  3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+   740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+  3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+    52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+  2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+  1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+  1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+  2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+   347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+  3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+};
+
+static const unsigned lodepng_crc32_table2[256] = {
+           0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+   236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+   472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+   305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+   944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+   912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+   611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+   712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+  1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+  2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+  1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+  1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+  1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+  1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+  1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+  1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+  3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+  4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+  4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+  4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+  3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+  3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+  3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+  3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+  2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+  2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+  2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+  2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+  2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+  2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+  3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+  3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+};
+
+static const unsigned lodepng_crc32_table3[256] = {
+           0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+  3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+  1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+  2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+  2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+  1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+  4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+   899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+  2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+  1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+  3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+   247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+   992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+  4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+  1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+  2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+  3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+   686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+  3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+  2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+  1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+  2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+   494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+  3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+  1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+  3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+   643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+  3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+  3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+   332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+  2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+  1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+};
+
+static const unsigned lodepng_crc32_table4[256] = {
+           0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+   812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+  1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+  1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+  3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+  4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+  2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+  2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+  1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+  1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+   940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+   140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+  2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+  2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+  4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+  3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+  2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+  2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+  3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+  3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+  1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+  1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+   281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+   548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+  3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+  3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+  2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+  3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+   685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+   413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+  1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+  2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+};
+
+static const unsigned lodepng_crc32_table5[256] = {
+           0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+  3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+    64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+  4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+   128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+  3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+    75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+  3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+   257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+  3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+   210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+  3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+   150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+  3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+   186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+  3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+   514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+  4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+   493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+  4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+   421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+  4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+   449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+  4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+   300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+  4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+   306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+  4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+   373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+  4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+   361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+  4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+};
+
+static const unsigned lodepng_crc32_table6[256] = {
+           0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+   871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+  1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+  1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+  3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+  4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+  2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+  2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+  1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+  2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+   601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+   272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+  2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+  3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+  3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+  3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+  2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+  3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+  4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+  3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+  1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+  1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+   544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+   328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+  3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+  4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+  2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+  2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+    60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+   810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+  1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+  1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+};
+
+static const unsigned lodepng_crc32_table7[256] = {
+           0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+  3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+  2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+  2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+  4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+   714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+  2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+  1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+   698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+  4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+  1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+  2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+  3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+    51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+  2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+  2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+  1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+  2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+   796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+  4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+  2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+  2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+  3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+    85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+  2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+  2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+   102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+  3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+  2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+  1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+  4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+   747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+};
+
+#ifdef LODEPNG_X86_DISPATCH
+/*loder extension: the CRC register after len bytes, len a multiple of 16 and at least 64, by folding with
+carry-less multiplication and a final Barrett reduction (Gopal et al., "Fast CRC Computation for Generic
+Polynomials Using PCLMULQDQ Instruction", Intel, 2009). The constants are 64-bit values split in 32-bit halves*/
+__attribute__((target("sse2,pclmul")))
+static unsigned crc32_pclmul(unsigned r, const unsigned char* data, size_t len) {
+  static const unsigned k1k2[4] = {0x54442bd4u, 0x00000001u, 0xc6e41596u, 0x00000001u};
+  static const unsigned k3k4[4] = {0x751997d0u, 0x00000001u, 0xccaa009eu, 0x00000000u};
+  static const unsigned k5k0[4] = {0x63cd6124u, 0x00000001u, 0x00000000u, 0x00000000u};
+  static const unsigned poly[4] = {0xdb710641u, 0x00000001u, 0xf7011641u, 0x00000001u};
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128((int)r));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+  x0 = _mm_loadu_si128((const __m128i*)k1k2);
+  data += 64;
+  len -= 64;
+
+  /*fold four 128-bit lanes at a time*/
+  while(len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)data));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 48)));
+    data += 64;
+    len -= 64;
+  }
+
+  /*fold the four lanes into one, then any remaining 16-byte blocks into that*/
+  x0 = _mm_loadu_si128((const __m128i*)k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x5), x2);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x5), x3);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x11), x5), x4);
+  while(len >= 16) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)data));
+    data += 16;
+    len -= 16;
+  }
+
+  /*fold 128 bits to 64*/
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadu_si128((const __m128i*)k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /*Barrett reduction to 32 bits*/
+  x0 = _mm_loadu_si128((const __m128i*)poly);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, x3), x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length) {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i) {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xffu] ^ (r >> 8u);
+#ifdef LODEPNG_X86_DISPATCH
+  /*loder extension: long runs use carry-less multiplication where the CPU has it*/
+  if(length >= 64 && __builtin_cpu_supports("pclmul")) {
+    r = crc32_pclmul(r, data, length & ~(size_t)15);
+    data += length & ~(size_t)15;
+    length &= 15;
+  }
+#endif /*LODEPNG_X86_DISPATCH*/
+  /*loder extension: slicing by eight, processing eight bytes per step with one table per byte position*/
+  while(length >= 8) {
+    r = lodepng_crc32_table7[(data[0] ^ r) & 0xffu] ^
+        lodepng_crc32_table6[(data[1] ^ (r >> 8u)) & 0xffu] ^
+        lodepng_crc32_table5[(data[2] ^ (r >> 16u)) & 0xffu] ^
+        lodepng_crc32_table4[(data[3] ^ (r >> 24u)) & 0xffu] ^
+        lodepng_crc32_table3[data[4]] ^
+        lodepng_crc32_table2[data[5]] ^
+        lodepng_crc32_table1[data[6]] ^
+        lodepng_crc32_table0[data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while(length--) {
+    r = lodepng_crc32_table0[(r ^ *data++) & 0xffu] ^ (r >> 8u);
   }
   return r ^ 0xffffffffu;
 }
@@ -4096,6 +5359,192 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_X86_DISPATCH
+/*loder extension: SIMD versions of the Sub, Up, Average and Paeth filters, specialised for each whole
+number of bytes per pixel. Sub, Average and Paeth depend on the pixel to the left, so these work one pixel
+at a time in the low bytes of a register, except that Sub with a power of two pixel size is a running sum
+done 16 bytes at a time. Pixels are loaded and stored byte for byte, since recon and scanline may be the
+same memory. The helpers are always inlined, so that the pixel size is a constant in each loop*/
+#define UNFILTER_INLINE __attribute__((target("sse2"), always_inline)) static __inline__
+
+UNFILTER_INLINE __m128i unfilterLoad_sse2(const unsigned char* p, size_t bytewidth) {
+  int v;
+  switch(bytewidth) {
+    case 1: return _mm_cvtsi32_si128(p[0]);
+    case 2: return _mm_cvtsi32_si128(p[0] | (p[1] << 8));
+    case 3: return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+    case 4: lodepng_memcpy(&v, p, 4); return _mm_cvtsi32_si128(v);
+    case 6: lodepng_memcpy(&v, p, 4); return _mm_insert_epi16(_mm_cvtsi32_si128(v), p[4] | (p[5] << 8), 2);
+    default: return _mm_loadl_epi64((const __m128i*)p);
+  }
+}
+
+UNFILTER_INLINE void unfilterStore_sse2(unsigned char* p, __m128i x, size_t bytewidth) {
+  int v = _mm_cvtsi128_si32(x);
+  switch(bytewidth) {
+    case 1: p[0] = (unsigned char)v; break;
+    case 2: p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); break;
+    case 3: p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); break;
+    case 4: lodepng_memcpy(p, &v, 4); break;
+    case 6:
+      lodepng_memcpy(p, &v, 4);
+      v = _mm_extract_epi16(x, 2);
+      p[4] = (unsigned char)v;
+      p[5] = (unsigned char)(v >> 8);
+      break;
+    default: _mm_storel_epi64((__m128i*)p, x); break;
+  }
+}
+
+/*Sub, which is also Paeth on the first row*/
+UNFILTER_INLINE void unfilterSub_sse2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth,
+                                      size_t length) {
+  __m128i a = _mm_setzero_si128();
+  size_t i = 0;
+  if(bytewidth != 3 && bytewidth != 6) {
+    for(; i + 16 <= length; i += 16) {
+      /*each pixel plus all those before it in the block, plus the last pixel of the block before*/
+      __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      if(bytewidth <= 1) x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+      if(bytewidth <= 2) x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+      if(bytewidth <= 4) x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi8(_mm_add_epi8(x, _mm_slli_si128(x, 8)), a);
+      _mm_storeu_si128((__m128i*)&recon[i], x);
+      /*repeat the last pixel across the register*/
+      if(bytewidth == 1) x = _mm_unpackhi_epi8(x, x);
+      if(bytewidth <= 2) x = _mm_shufflehi_epi16(x, 0xff);
+      a = bytewidth == 8 ? _mm_unpackhi_epi64(x, x) : _mm_shuffle_epi32(x, 0xff);
+    }
+  }
+  for(; i != length; i += bytewidth) {
+    a = _mm_add_epi8(a, unfilterLoad_sse2(&scanline[i], bytewidth));
+    unfilterStore_sse2(&recon[i], a, bytewidth);
+  }
+}
+
+/*Average with a previous row, flooring the rounded average of unsigned bytes*/
+UNFILTER_INLINE void unfilterAverage_sse2(unsigned char* recon, const unsigned char* scanline,
+                                          const unsigned char* precon, size_t bytewidth, size_t length) {
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = unfilterLoad_sse2(&precon[i], bytewidth);
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(unfilterLoad_sse2(&scanline[i], bytewidth), average);
+    unfilterStore_sse2(&recon[i], a, bytewidth);
+  }
+}
+
+/*Paeth with a previous row, on 16-bit lanes, choosing as paethPredictor does: a, then b, then c on ties*/
+UNFILTER_INLINE void unfilterPaeth_sse2(unsigned char* recon, const unsigned char* scanline,
+                                        const unsigned char* precon, size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128(), low = _mm_set1_epi16(255);
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(unfilterLoad_sse2(&precon[i], bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(unfilterLoad_sse2(&scanline[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc = _mm_add_epi16(pa, pb), least, is_a, is_b;
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    least = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    is_a = _mm_cmpeq_epi16(least, pa);
+    is_b = _mm_andnot_si128(is_a, _mm_cmpeq_epi16(least, pb));
+    c = _mm_andnot_si128(_mm_or_si128(is_a, is_b), c);
+    c = _mm_or_si128(c, _mm_or_si128(_mm_and_si128(is_a, a), _mm_and_si128(is_b, b)));
+    a = _mm_and_si128(_mm_add_epi16(x, c), low);
+    unfilterStore_sse2(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*the same with SSSE3's absolute values and SSE4.1's blends, which shorten the chain from pixel to pixel*/
+__attribute__((target("ssse3,sse4.1"), always_inline)) static __inline__
+void unfilterPaeth_sse41(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                         size_t bytewidth, size_t length) {
+  const __m128i zero = _mm_setzero_si128(), low = _mm_set1_epi16(255);
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(unfilterLoad_sse2(&precon[i], bytewidth), zero);
+    __m128i x = _mm_unpacklo_epi8(unfilterLoad_sse2(&scanline[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc = _mm_add_epi16(pa, pb), least, nearest;
+    pa = _mm_abs_epi16(pa);
+    pb = _mm_abs_epi16(pb);
+    pc = _mm_abs_epi16(pc);
+    least = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    nearest = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(least, pb));
+    nearest = _mm_blendv_epi8(nearest, a, _mm_cmpeq_epi16(least, pa));
+    a = _mm_and_si128(_mm_add_epi16(x, nearest), low);
+    unfilterStore_sse2(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*unfilter a scanline with SSE2 if the filter and pixel size have a version here, returning whether it did*/
+__attribute__((target("sse2")))
+static unsigned unfilterScanline_sse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                      size_t bytewidth, unsigned char filterType, size_t length) {
+  if(filterType == 2 && precon) {
+    size_t i = 0;
+    for(; i + 16 <= length; i += 16) {
+      __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, _mm_loadu_si128((const __m128i*)&precon[i])));
+    }
+    for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+    return 1;
+  } else if(filterType == 1 || (filterType == 4 && !precon)) {
+    switch(bytewidth) {
+      case 1: unfilterSub_sse2(recon, scanline, 1, length); return 1;
+      case 2: unfilterSub_sse2(recon, scanline, 2, length); return 1;
+      case 3: unfilterSub_sse2(recon, scanline, 3, length); return 1;
+      case 4: unfilterSub_sse2(recon, scanline, 4, length); return 1;
+      case 6: unfilterSub_sse2(recon, scanline, 6, length); return 1;
+      case 8: unfilterSub_sse2(recon, scanline, 8, length); return 1;
+      default: break;
+    }
+  } else if(filterType == 3 && precon) {
+    switch(bytewidth) {
+      case 1: unfilterAverage_sse2(recon, scanline, precon, 1, length); return 1;
+      case 2: unfilterAverage_sse2(recon, scanline, precon, 2, length); return 1;
+      case 3: unfilterAverage_sse2(recon, scanline, precon, 3, length); return 1;
+      case 4: unfilterAverage_sse2(recon, scanline, precon, 4, length); return 1;
+      case 6: unfilterAverage_sse2(recon, scanline, precon, 6, length); return 1;
+      case 8: unfilterAverage_sse2(recon, scanline, precon, 8, length); return 1;
+      default: break;
+    }
+  } else if(filterType == 4) {
+    switch(bytewidth) {
+      case 1: unfilterPaeth_sse2(recon, scanline, precon, 1, length); return 1;
+      case 2: unfilterPaeth_sse2(recon, scanline, precon, 2, length); return 1;
+      case 3: unfilterPaeth_sse2(recon, scanline, precon, 3, length); return 1;
+      case 4: unfilterPaeth_sse2(recon, scanline, precon, 4, length); return 1;
+      case 6: unfilterPaeth_sse2(recon, scanline, precon, 6, length); return 1;
+      case 8: unfilterPaeth_sse2(recon, scanline, precon, 8, length); return 1;
+      default: break;
+    }
+  }
+  return 0;
+}
+
+/*unfilter a Paeth scanline with a previous row with SSE4.1 if the pixel size has a version here*/
+__attribute__((target("ssse3,sse4.1")))
+static unsigned unfilterPaethScanline_sse41(unsigned char* recon, const unsigned char* scanline,
+                                            const unsigned char* precon, size_t bytewidth, size_t length) {
+  switch(bytewidth) {
+    case 1: unfilterPaeth_sse41(recon, scanline, precon, 1, length); return 1;
+    case 2: unfilterPaeth_sse41(recon, scanline, precon, 2, length); return 1;
+    case 3: unfilterPaeth_sse41(recon, scanline, precon, 3, length); return 1;
+    case 4: unfilterPaeth_sse41(recon, scanline, precon, 4, length); return 1;
+    case 6: unfilterPaeth_sse41(recon, scanline, precon, 6, length); return 1;
+    case 8: unfilterPaeth_sse41(recon, scanline, precon, 8, length); return 1;
+    default: return 0;
+  }
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length) {
   /*
@@ -4108,6 +5557,14 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_X86_DISPATCH
+  /*loder extension: the usual pixel sizes go through SIMD versions, chosen by what the CPU supports*/
+  if(filterType == 4 && precon && __builtin_cpu_supports("sse4.1")) {
+    if(unfilterPaethScanline_sse41(recon, scanline, precon, bytewidth, length)) return 0;
+  } else if(filterType != 0 && __builtin_cpu_supports("sse2")) {
+    if(unfilterScanline_sse2(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+  }
+#endif /*LODEPNG_X86_DISPATCH*/
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -4266,38 +5723,44 @@ in is possibly bigger due to padding bits between reduced images.
 out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation
 (because that's likely a little bit faster)
 NOTE: comments about padding bits are only relevant if bpp < 8
+loder extension: if shift is nonzero, only the first 7 - 2 * shift passes are used, which together form
+the image reduced by a factor of 2^shift in each dimension, and out has that reduced size
 */
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp) {
+static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                              unsigned shift) {
   unsigned passw[7], passh[7];
   size_t filter_passstart[8], padded_passstart[8], passstart[8];
   unsigned i;
+  unsigned passes = 7 - 2 * shift;
+  unsigned ow = (w + (1u << shift) - 1u) >> shift;
 
   Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
   if(bpp >= 8) {
-    for(i = 0; i != 7; ++i) {
+    for(i = 0; i != passes; ++i) {
       unsigned x, y, b;
       size_t bytewidth = bpp / 8u;
       for(y = 0; y < passh[i]; ++y)
       for(x = 0; x < passw[i]; ++x) {
         size_t pixelinstart = passstart[i] + (y * passw[i] + x) * bytewidth;
-        size_t pixeloutstart = ((ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) * (size_t)w
-                             + ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) * bytewidth;
+        size_t pixeloutstart = (((ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) >> shift) * (size_t)ow
+                             + ((ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) >> shift)) * bytewidth;
         for(b = 0; b < bytewidth; ++b) {
           out[pixeloutstart + b] = in[pixelinstart + b];
         }
       }
     }
   } else /*bpp < 8: Adam7 with pixels < 8 bit is a bit trickier: with bit pointers*/ {
-    for(i = 0; i != 7; ++i) {
+    for(i = 0; i != passes; ++i) {
       unsigned x, y, b;
       unsigned ilinebits = bpp * passw[i];
-      unsigned olinebits = bpp * w;
+      unsigned olinebits = bpp * ow;
       size_t obp, ibp; /*bit pointers (for out and in buffer)*/
       for(y = 0; y < passh[i]; ++y)
       for(x = 0; x < passw[i]; ++x) {
         ibp = (8 * passstart[i]) + (y * ilinebits + x * bpp);
-        obp = (ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) * olinebits + (ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) * bpp;
+        obp = ((ADAM7_IY[i] + (size_t)y * ADAM7_DY[i]) >> shift) * olinebits
+            + ((ADAM7_IX[i] + (size_t)x * ADAM7_DX[i]) >> shift) * bpp;
         for(b = 0; b < bpp; ++b) {
           unsigned char bit = readBitFromReversedStream(&ibp, in);
           setBitOfReversedStream(&obp, out, bit);
@@ -4335,13 +5798,14 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 the IDAT chunks (with filter index bytes and possible padding bits)
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png) {
+                                     unsigned w, unsigned h, unsigned shift, const LodePNGInfo* info_png) {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
   Steps:
   *) if no Adam7: 1) unfilter 2) remove padding bits (= possible extra bits per scanline if bpp < 8)
   *) if adam7: 1) 7x unfilter 2) 7x remove padding bits 3) Adam7_deinterlace
   NOTE: the in buffer will be overwritten with intermediate data!
+  loder extension: for Adam7, a nonzero shift uses only the early passes, as described at Adam7_deinterlace
   */
   unsigned bpp = lodepng_get_bpp(&info_png->color);
   if(bpp == 0) return 31; /*error: invalid colortype*/
@@ -4359,7 +5823,7 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
-    for(i = 0; i != 7; ++i) {
+    for(i = 0; i != 7 - 2 * shift; ++i) {
       CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
       /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
       move bytes instead of bits or move not at all*/
@@ -4371,7 +5835,7 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
       }
     }
 
-    Adam7_deinterlace(out, in, w, h, bpp);
+    Adam7_deinterlace(out, in, w, h, bpp, shift);
   }
 
   return 0;
@@ -4827,17 +6291,292 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
   return error;
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+/*loder extension: the state shared by the threads of decodeRows. The rows are divided into batches, which
+pass from stage to stage at barriers: in each round, one thread decompresses the next batch, another
+unfilters the batch before, and any others pass on the batch before that. Every thread passes the same
+number of barriers, two more than the number of batches, whether or not it has work in a given round*/
+typedef struct RowPipeline {
+  const LodePNGDecoderSettings* settings;
+  const unsigned char* scanlines; /*reserved in full beforehand, so it does not move while decompressing*/
+  unsigned char* rows; /*the unfiltered rows, without filter bytes*/
+  size_t linebytes, bytewidth;
+  unsigned numrows, batchrows, numbatches;
+  unsigned reached; /*the number of batches decompressed, known only to the decompressing thread*/
+  unsigned char* status; /*for each batch, 1 once decompressed and 2 once unfiltered*/
+  unsigned concurrent; /*whether other threads are waiting at barriers for the decompressing thread*/
+} RowPipeline;
+
+static size_t pipelineBatchEnd(const RowPipeline* p, unsigned batch) {
+  size_t end = (size_t)(batch + 1) * p->batchrows;
+  if(end > p->numrows) end = p->numrows;
+  return end * (p->linebytes + 1u);
+}
+
+static void pipelineBarrier(const RowPipeline* p) {
+  if(p->concurrent) {
+#ifdef _OPENMP
+    #pragma omp barrier
+#endif
+  }
+}
+
+/*progress function for the decompressor: marks each batch as decompressed, which ends a round*/
+static size_t pipelineProgress(size_t size, void* context) {
+  RowPipeline* p = (RowPipeline*)context;
+  while(p->reached < p->numbatches && size >= pipelineBatchEnd(p, p->reached)) {
+    p->status[p->reached++] = 1;
+    pipelineBarrier(p);
+  }
+  return p->reached < p->numbatches ? pipelineBatchEnd(p, p->reached) : 0;
+}
+
+static unsigned pipelineUnfilter(RowPipeline* p, unsigned batch) {
+  unsigned y = batch * p->batchrows;
+  unsigned end = p->numrows - y > p->batchrows ? y + p->batchrows : p->numrows;
+  for(; y < end; ++y) {
+    const unsigned char* scanline = &p->scanlines[y * (p->linebytes + 1u)];
+    unsigned char* precon = y ? &p->rows[(y - 1u) * p->linebytes] : 0;
+    CERROR_TRY_RETURN(unfilterScanline(&p->rows[y * p->linebytes], scanline + 1, precon, p->bytewidth,
+                                       scanline[0], p->linebytes));
+  }
+  p->status[batch] = 2;
+  return 0;
+}
+
+/*pass on part of a batch of unfiltered rows, splitting it into parts of whole multiples of 16 rows*/
+static unsigned pipelinePassOn(const RowPipeline* p, unsigned batch, unsigned part, unsigned numparts) {
+  unsigned first = batch * p->batchrows;
+  unsigned count = p->numrows - first > p->batchrows ? p->batchrows : p->numrows - first;
+  unsigned blocks = (count + 15u) / 16u;
+  unsigned start = 16u * (unsigned)((size_t)blocks * part / numparts);
+  unsigned end = 16u * (unsigned)((size_t)blocks * (part + 1u) / numparts);
+  if(end > count) end = count;
+  if(start >= end) return 0;
+  return p->settings->row_callback(&p->rows[(first + start) * p->linebytes], first + start, end - start,
+                                   p->settings->row_context);
+}
+
+/*loder extension: the state of decodeRows on a single thread. The decompressor keeps only a window at the
+end of the stream, and each batch of rows is unfiltered and passed on as soon as it is complete*/
+typedef struct RowStream {
+  const LodePNGDecoderSettings* settings;
+  const ucvector* scanlines; /*the window, which ends at the size passed to the progress function*/
+  unsigned char* rows; /*the last row of the batch before, followed by the rows of the current batch*/
+  size_t linebytes, bytewidth;
+  unsigned numrows, batchrows, done;
+  unsigned error;
+} RowStream;
+
+/*progress function for the decompressor: passes on every batch of rows completed since the last call*/
+static size_t streamProgress(size_t size, void* context) {
+  RowStream* p = (RowStream*)context;
+  size_t linesize = p->linebytes + 1u;
+  size_t start = size - p->scanlines->size; /*the position in the stream of the start of the window*/
+  while(!p->error && p->done < p->numrows) {
+    unsigned y, end = p->numrows - p->done > p->batchrows ? p->done + p->batchrows : p->numrows;
+    if(size < end * linesize) return end * linesize;
+    for(y = p->done; y < end && !p->error; ++y) {
+      const unsigned char* scanline = &p->scanlines->data[y * linesize - start];
+      unsigned char* row = &p->rows[(y - p->done + 1u) * p->linebytes];
+      p->error = unfilterScanline(row, scanline + 1, y ? row - p->linebytes : 0, p->bytewidth,
+                                  scanline[0], p->linebytes);
+    }
+    if(!p->error) {
+      p->error = p->settings->row_callback(&p->rows[p->linebytes], p->done, end - p->done,
+                                           p->settings->row_context);
+    }
+    lodepng_memcpy(p->rows, &p->rows[(end - p->done) * p->linebytes], p->linebytes);
+    p->done = end;
+  }
+  return 0;
+}
+
+/*the single-threaded version of decodeRows, which holds no more than a few batches of scanlines*/
+static unsigned decodeRowsStream(LodePNGWorkspace* workspace, const LodePNGPiece* pieces, size_t numpieces,
+                                 unsigned w, unsigned h, size_t expected_size, LodePNGDecompressSettings* zlibsettings,
+                                 const LodePNGDecoderSettings* settings, unsigned bpp) {
+  RowStream p;
+  ucvector v = ucvector_init(NULL, 0);
+  size_t discarded = 0, batchsize;
+  unsigned error = 0;
+
+  if(workspace) v = workspace->scanlines;
+  v.size = 0;
+
+  p.settings = settings;
+  p.scanlines = &v;
+  p.bytewidth = (bpp + 7u) / 8u;
+  p.linebytes = lodepng_get_raw_size_idat(w, 1, bpp) - 1u;
+  p.numrows = h;
+  /*batches of about 64KiB, in multiples of 16 rows unless they are very long*/
+  p.batchrows = (unsigned)(65536u / p.linebytes) & ~15u;
+  if(p.batchrows == 0) p.batchrows = p.linebytes < 65536u ? (unsigned)(65536u / p.linebytes) : 1u;
+  p.done = 0;
+  p.error = 0;
+  batchsize = p.batchrows * (p.linebytes + 1u);
+
+  /*the window must hold the unfinished batch as well as the reach of deflate*/
+  if(!zlibsettings->max_output_size || zlibsettings->max_output_size > expected_size + 65536u) {
+    zlibsettings->max_output_size = expected_size + 65536u;
+  }
+  zlibsettings->progress = streamProgress;
+  zlibsettings->progress_context = &p;
+  zlibsettings->window_size = 32768u + batchsize;
+
+  p.rows = (unsigned char*)lodepng_malloc((p.batchrows + 1u) * p.linebytes);
+  if(!p.rows) error = 83; /*alloc fail*/
+  else error = zlibDecompressPieces(&v, &discarded, pieces, numpieces, zlibsettings);
+
+  /*decompression stopped early may overshoot the requested rows, which are then ignored*/
+  if(!error && discarded + v.size != expected_size
+     && !(discarded + v.size > expected_size && zlibsettings->stop_output_size)) {
+    error = 91; /*decompressed size doesn't match prediction*/
+  }
+  if(workspace) workspace->scanlines = v;
+  else lodepng_free(v.data);
+  lodepng_free(p.rows);
+  return error ? error : p.error;
+}
+
+/*Decompress the first h scanlines of a non-interlaced image of the given height, and pass on the rows to
+the row callback as they are unfiltered. With an index to the zlib stream from a loIX chunk and more than
+one thread, the segments are decompressed concurrently first. On a single thread, only a window of the
+scanlines is kept. The buffer of scanlines is kept in the workspace if there is one.*/
+static unsigned decodeRows(LodePNGWorkspace* workspace, const LodePNGPiece* pieces, size_t numpieces,
+                           const unsigned char* index, size_t indexsize, unsigned w, unsigned h, unsigned height,
+                           size_t expected_size, LodePNGDecompressSettings* zlibsettings,
+                           const LodePNGDecoderSettings* settings, const LodePNGColorMode* color) {
+  RowPipeline p;
+  ucvector v = ucvector_init(NULL, 0);
+  unsigned bpp = lodepng_get_bpp(color), rounds, indexed = 0;
+  unsigned inflate_error = 0, unfilter_error = 0, callback_error = 0;
+  /*a stored block may overshoot the last row wanted by up to 65535 bytes, and Huffman blocks keep some
+  room in hand, so reserving this much means the buffer never has to grow*/
+  size_t limit = expected_size + 65536u;
+
+  if(bpp == 0) return 31; /*error: invalid colortype*/
+#ifdef _OPENMP
+  if(settings->threads <= 1)
+#endif
+  {
+    return decodeRowsStream(workspace, pieces, numpieces, w, h, expected_size, zlibsettings, settings, bpp);
+  }
+  if(workspace) v = workspace->scanlines;
+  v.size = 0;
+
+  p.settings = settings;
+  p.bytewidth = (bpp + 7u) / 8u;
+  p.linebytes = lodepng_get_raw_size_idat(w, 1, bpp) - 1u;
+  p.numrows = h;
+  /*batches of about 64KiB, in multiples of 16 rows*/
+  p.batchrows = (unsigned)(65536u / p.linebytes) & ~15u;
+  if(p.batchrows == 0) p.batchrows = 16;
+  p.numbatches = (h + p.batchrows - 1u) / p.batchrows;
+  p.reached = 0;
+  p.concurrent = 0;
+  rounds = p.numbatches + 2u;
+
+  if(!zlibsettings->max_output_size || zlibsettings->max_output_size > limit) zlibsettings->max_output_size = limit;
+  zlibsettings->progress = pipelineProgress;
+  zlibsettings->progress_context = &p;
+
+  p.rows = (unsigned char*)lodepng_malloc(p.linebytes * h);
+  p.status = (unsigned char*)lodepng_malloc(p.numbatches);
+  if(!p.rows || !p.status || !ucvector_reserve(&v, zlibsettings->max_output_size + 1024u)) {
+    inflate_error = 83; /*alloc fail*/
+  } else {
+    lodepng_memset(p.status, 0, p.numbatches);
+    p.scanlines = v.data;
+    if(index && settings->threads > 1) {
+      indexed = !inflateIndexed(&v, pieces, numpieces, index, indexsize, p.linebytes + 1u, height, expected_size,
+                                zlibsettings, settings->threads);
+      if(!indexed) v.size = 0;
+    }
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(settings->threads ? settings->threads : 1)
+#endif
+    {
+      unsigned id = 0, numthreads = 1, round, batch;
+#ifdef _OPENMP
+      id = (unsigned)omp_get_thread_num();
+      numthreads = (unsigned)omp_get_num_threads();
+#endif
+      if(id == 0) {
+        p.concurrent = (numthreads > 1);
+        if(indexed) pipelineProgress(v.size, &p);
+        else inflate_error = zlibDecompressPieces(&v, NULL, pieces, numpieces, zlibsettings);
+        /*pass the barriers of any rounds left, if decompression stopped short*/
+        for(round = p.reached; round < rounds; ++round) pipelineBarrier(&p);
+        /*on its own, this thread does everything in turn*/
+        for(batch = 0; numthreads == 1 && batch < p.numbatches && p.status[batch] == 1; ++batch) {
+          unfilter_error = pipelineUnfilter(&p, batch);
+          if(!unfilter_error) callback_error = pipelinePassOn(&p, batch, 0, 1);
+          if(unfilter_error || callback_error) break;
+        }
+      } else {
+        unsigned error = 0;
+        for(round = 0; round < rounds; ++round) {
+          if(id == 1 && round >= 1 && round - 1u < p.numbatches && !unfilter_error) {
+            /*the batch decompressed in the round before*/
+            batch = round - 1u;
+            if(p.status[batch] == 1) {
+              unfilter_error = pipelineUnfilter(&p, batch);
+              if(!unfilter_error && numthreads == 2 && !error) error = pipelinePassOn(&p, batch, 0, 1);
+            }
+          } else if(id >= 2 && round >= 2 && round - 2u < p.numbatches && !error) {
+            /*the batch unfiltered in the round before*/
+            batch = round - 2u;
+            if(p.status[batch] == 2) error = pipelinePassOn(&p, batch, id - 2u, numthreads - 2u);
+          }
+#ifdef _OPENMP
+          #pragma omp barrier
+#endif
+        }
+        if(error) {
+#ifdef _OPENMP
+          #pragma omp critical
+#endif
+          callback_error = error;
+        }
+      }
+    }
+  }
+
+  /*decompression stopped early may overshoot the requested rows, which are then ignored*/
+  if(!inflate_error && v.size != expected_size && !(v.size > expected_size && zlibsettings->stop_output_size)) {
+    inflate_error = 91; /*decompressed size doesn't match prediction*/
+  }
+  if(workspace) workspace->scanlines = v;
+  else lodepng_free(v.data);
+  lodepng_free(p.rows);
+  lodepng_free(p.status);
+  return inflate_error ? inflate_error : (unfilter_error ? unfilter_error : callback_error);
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
                           const unsigned char* in, size_t insize) {
   unsigned char IEND = 0;
   const unsigned char* chunk; /*points to beginning of next chunk*/
-  unsigned char* idat; /*the data from idat chunks, zlib compressed*/
+  /*loder extension: the data from idat chunks, zlib compressed, are read in place as pieces. The first is
+  held here, so that no allocation is needed for the usual single IDAT chunk*/
+  LodePNGPiece first;
+  LodePNGPiece* pieces = &first;
+  size_t numpieces = 0, allocpieces = 1;
+  unsigned char* joined = 0; /*the pieces concatenated, for custom decompressors*/
   size_t idatsize = 0;
   unsigned char* scanlines = 0;
   size_t scanlines_size = 0, expected_size = 0;
   size_t outsize = 0;
+  LodePNGDecompressSettings zlibsettings;
+  unsigned rows; /*number of rows to decode*/
+  unsigned shift = 0; /*log2 of the reduction factor of an interlaced image*/
+  unsigned kept_scanlines = 0; /*whether the scanlines belong to the workspace*/
+  const unsigned char* index = 0; /*the data of any loIX chunk*/
+  size_t indexsize = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4857,14 +6596,13 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     CERROR_RETURN(state->error, 92); /*overflow possible due to amount of pixels*/
   }
 
-  /*the input filesize is a safe upper bound for the sum of idat chunks size*/
-  idat = (unsigned char*)lodepng_malloc(insize);
-  if(!idat) CERROR_RETURN(state->error, 83); /*alloc fail*/
+  zlibsettings = state->decoder.zlibsettings;
+  rows = *h;
 
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
-  IDAT data is put at the start of the in buffer*/
+  IDAT data is listed in pieces*/
   while(!IEND && !state->error) {
     unsigned chunkLength;
     const unsigned char* data; /*the data in the chunk*/
@@ -4897,8 +6635,21 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       size_t newsize;
       if(lodepng_addofl(idatsize, chunkLength, &newsize)) CERROR_BREAK(state->error, 95);
       if(newsize > insize) CERROR_BREAK(state->error, 95);
-      lodepng_memcpy(idat + idatsize, data, chunkLength);
-      idatsize += chunkLength;
+      if(chunkLength) {
+        if(numpieces == allocpieces) {
+          LodePNGPiece* grown = (LodePNGPiece*)lodepng_realloc(pieces == &first ? 0 : pieces,
+                                                               2u * allocpieces * sizeof(LodePNGPiece));
+          if(!grown) CERROR_BREAK(state->error, 83); /*alloc fail*/
+          if(pieces == &first) grown[0] = first;
+          pieces = grown;
+          allocpieces *= 2u;
+        }
+        pieces[numpieces].data = data;
+        pieces[numpieces].size = chunkLength;
+        pieces[numpieces].offset = idatsize;
+        ++numpieces;
+      }
+      idatsize = newsize;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4918,6 +6669,10 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       affects the alpha channel of pixels. */
       state->error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
       if(state->error) break;
+    } else if(lodepng_chunk_type_equals(chunk, "loIX")) {
+      /*loder extension: the restart points of the zlib stream, as written with restart_rows*/
+      index = data;
+      indexsize = chunkLength;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       /*background color chunk (bKGD)*/
     } else if(lodepng_chunk_type_equals(chunk, "bKGD")) {
@@ -4990,12 +6745,36 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     state->error = 106; /* error: PNG file must have PLTE chunk if color type is palette */
   }
 
+  if(numpieces == 0) {
+    first.data = in;
+    first.size = 0;
+    first.offset = 0;
+    numpieces = 1;
+  }
+  if(!state->error && numpieces > 1 && (zlibsettings.custom_zlib || zlibsettings.custom_inflate)) {
+    /*custom decompressors are given the data in one piece*/
+    joined = (unsigned char*)lodepng_malloc(idatsize);
+    if(!joined) state->error = 83; /*alloc fail*/
+    else pieces_copy(joined, pieces, numpieces, 0, idatsize);
+    lodepng_free(pieces);
+    first.data = joined;
+    first.size = idatsize;
+    first.offset = 0;
+    pieces = &first;
+    numpieces = 1;
+  }
+
   if(!state->error) {
     /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
     If the decompressed size does not match the prediction, the image must be corrupt.*/
     if(state->info_png.interlace_method == 0) {
       size_t bpp = lodepng_get_bpp(&state->info_png.color);
-      expected_size = lodepng_get_raw_size_idat(*w, *h, bpp);
+      /*loder extension: only the scanlines of the requested rows need be decompressed*/
+      if(state->decoder.max_rows && state->decoder.max_rows < *h) {
+        rows = state->decoder.max_rows;
+        zlibsettings.stop_output_size = lodepng_get_raw_size_idat(*w, rows, bpp);
+      }
+      expected_size = lodepng_get_raw_size_idat(*w, rows, bpp);
     } else {
       size_t bpp = lodepng_get_bpp(&state->info_png.color);
       /*Adam-7 interlaced: expected size is the sum of the 7 sub-images sizes*/
@@ -5007,23 +6786,66 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       expected_size += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, bpp);
       if(*w > 1) expected_size += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, bpp);
       expected_size += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, bpp);
+
+      /*loder extension: the first 1, 3 or 5 passes form the image reduced by 8, 4 or 2 in each dimension,
+      and only those passes need be decompressed*/
+      if(state->decoder.adam7_passes == 1 || state->decoder.adam7_passes == 3 || state->decoder.adam7_passes == 5) {
+        unsigned passw[7], passh[7];
+        size_t filter_passstart[8], padded_passstart[8], passstart[8];
+        Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, *w, *h, (unsigned)bpp);
+        shift = (7 - state->decoder.adam7_passes) / 2;
+        expected_size = filter_passstart[state->decoder.adam7_passes];
+        zlibsettings.stop_output_size = expected_size;
+      }
     }
 
-    state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &state->decoder.zlibsettings);
+#ifdef LODEPNG_COMPILE_ZLIB
+    if(state->decoder.row_callback && state->info_png.interlace_method == 0
+       && !zlibsettings.custom_zlib && !zlibsettings.custom_inflate) {
+      /*loder extension: the rows are passed on as they are decoded, rather than returned*/
+      state->error = decodeRows(state->decoder.workspace, pieces, numpieces, index, indexsize, *w, rows, *h,
+                                expected_size, &zlibsettings, &state->decoder, &state->info_png.color);
+      if(pieces != &first) lodepng_free(pieces);
+      *h = rows;
+      return;
+    }
+    if(!zlibsettings.custom_zlib) {
+      /*loder extension: decompress from the pieces in place, into the buffer kept in the workspace if there
+      is one, growing it if need be*/
+      LodePNGWorkspace* workspace = state->decoder.workspace;
+      ucvector v = workspace ? workspace->scanlines : ucvector_init(NULL, 0);
+      v.size = 0;
+      if(!ucvector_reserve(&v, expected_size)) state->error = 83; /*alloc fail*/
+      else state->error = zlibDecompressPieces(&v, NULL, pieces, numpieces, &zlibsettings);
+      if(workspace) workspace->scanlines = v;
+      scanlines = v.data;
+      scanlines_size = v.size;
+      kept_scanlines = workspace != 0;
+    } else
+#endif /*LODEPNG_COMPILE_ZLIB*/
+    state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, pieces[0].data, idatsize,
+                                   &zlibsettings);
   }
+  /*decompression stopped early may overshoot the requested rows, which are then ignored*/
+  if(!state->error && scanlines_size > expected_size && zlibsettings.stop_output_size) scanlines_size = expected_size;
   if(!state->error && scanlines_size != expected_size) state->error = 91; /*decompressed size doesn't match prediction*/
-  lodepng_free(idat);
+  if(pieces != &first) lodepng_free(pieces);
+  lodepng_free(joined);
 
   if(!state->error) {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+    outsize = lodepng_get_raw_size((*w + (1u << shift) - 1u) >> shift, (rows + (1u << shift) - 1u) >> shift,
+                                   &state->info_png.color);
     *out = (unsigned char*)lodepng_malloc(outsize);
     if(!*out) state->error = 83; /*alloc fail*/
   }
   if(!state->error) {
     lodepng_memset(*out, 0, outsize);
-    state->error = postProcessScanlines(*out, scanlines, *w, *h, &state->info_png);
+    state->error = postProcessScanlines(*out, scanlines, *w, rows, shift, &state->info_png);
+    /*report the size of the image actually decoded*/
+    *w = (*w + (1u << shift) - 1u) >> shift;
+    *h = (rows + (1u << shift) - 1u) >> shift;
   }
-  lodepng_free(scanlines);
+  if(!kept_scanlines) lodepng_free(scanlines);
 }
 
 unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
@@ -5032,6 +6854,8 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
   *out = 0;
   decodeGeneric(out, w, h, state, in, insize);
   if(state->error) return state->error;
+  /*loder extension: rows passed to the row callback are not returned, so there is nothing to convert*/
+  if(!*out) return 0;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)) {
     /*same color type, no copying or converting of data needed*/
     /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
@@ -5114,6 +6938,12 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings) {
   settings->color_convert = 1;
+  settings->max_rows = 0;
+  settings->adam7_passes = 0;
+  settings->workspace = 0;
+  settings->row_callback = 0;
+  settings->row_context = 0;
+  settings->threads = 1;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -5265,6 +7095,124 @@ static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t d
   return error;
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+/*loder extension: state for writing IDAT chunks straight to the custom output*/
+typedef struct {
+  ucvector chunk;
+  const LodePNGEncoderSettings* settings;
+} IDATStream;
+
+static unsigned flushIDAT(ucvector* out, size_t complete, void* context) {
+  IDATStream* stream = (IDATStream*)context;
+  unsigned error = 0;
+  if(complete == 0) return 0;
+  if(complete > 2147483647u) return 77; /*chunk too large*/
+  stream->chunk.size = 0;
+  error = lodepng_chunk_createv(&stream->chunk, (unsigned)complete, "IDAT", out->data);
+  if(!error) error = stream->settings->custom_output(stream->chunk.data, stream->chunk.size,
+                                                      stream->settings->output_context);
+  /*at most one partially written byte remains*/
+  if(out->size > complete) out->data[0] = out->data[complete];
+  out->size -= complete;
+  return error;
+}
+
+/*compress the image data into a series of IDAT chunks, passing each to the custom output in turn*/
+static unsigned streamChunks_IDAT(const unsigned char* data, size_t datasize,
+                                  const LodePNGEncoderSettings* settings) {
+  unsigned error = 0;
+  ucvector zlib = ucvector_init(NULL, 0);
+  IDATStream stream;
+  /*the same zlib header as lodepng_zlib_compress: CM 8, CINFO 7, no dictionary*/
+  unsigned CMFFLG = 256 * 120;
+  CMFFLG += 31 - CMFFLG % 31;
+
+  stream.chunk = ucvector_init(NULL, 0);
+  stream.settings = settings;
+
+  if(!ucvector_resize(&zlib, 2)) return 83; /*alloc fail*/
+  zlib.data[0] = (unsigned char)(CMFFLG >> 8);
+  zlib.data[1] = (unsigned char)(CMFFLG & 255);
+
+  error = lodepng_deflatev(&zlib, data, datasize, &settings->zlibsettings, flushIDAT, &stream);
+  if(!error) {
+    if(!ucvector_resize(&zlib, zlib.size + 4)) error = 83; /*alloc fail*/
+  }
+  if(!error) {
+    lodepng_set32bitInt(&zlib.data[zlib.size - 4],
+                        adler32_threads(data, datasize, settings->zlibsettings.threads));
+    error = flushIDAT(&zlib, zlib.size, &stream);
+  }
+
+  lodepng_free(zlib.data);
+  lodepng_free(stream.chunk.data);
+  return error;
+}
+
+/*loder extension: compress the image data in independent segments of the given number of rows each, as
+IDAT chunks passed to the custom output if there is one, and otherwise added to out. The offsets of the
+segments follow in a loIX chunk, which is added to out*/
+static unsigned addChunks_IDAT_indexed(ucvector* out, const unsigned char* data, size_t datasize,
+                                       size_t linebytes, const LodePNGEncoderSettings* settings) {
+  unsigned error = 0;
+  ucvector zlib = ucvector_init(NULL, 0);
+  RestartIndex index;
+  IDATStream stream;
+  const LodePNGCompressSettings* zlibsettings = &settings->zlibsettings;
+  size_t blocksize = 262144, segmentsize;
+  unsigned rows = settings->restart_rows, CMFFLG = 256 * 120;
+  CMFFLG += 31 - CMFFLG % 31;
+
+  if(zlibsettings->btype > 2) return 61;
+  if(zlibsettings->btype == 2) {
+    blocksize = datasize / 8u + 8;
+    if(blocksize < 65536) blocksize = 65536;
+    if(blocksize > 262144) blocksize = 262144;
+  }
+  /*no segment is larger than the image, and each segment's Adler-32 is computed in one piece*/
+  if(rows > datasize / linebytes) rows = (unsigned)(datasize / linebytes);
+  segmentsize = linebytes * rows;
+  if(segmentsize > 2147483647u) return 77; /*too large*/
+
+  index.entries = ucvector_init(NULL, 0);
+  index.adler = 1u;
+  stream.chunk = ucvector_init(NULL, 0);
+  stream.settings = settings;
+
+  if(!ucvector_resize(&index.entries, 4) || !ucvector_resize(&zlib, 2)) error = 83; /*alloc fail*/
+  if(!error) {
+    lodepng_set32bitInt(index.entries.data, rows);
+    zlib.data[0] = (unsigned char)(CMFFLG >> 8);
+    zlib.data[1] = (unsigned char)(CMFFLG & 255);
+    error = deflateSegments(&zlib, data, datasize, segmentsize, blocksize, zlibsettings, &index,
+                            settings->custom_output ? flushIDAT : NULL, &stream);
+  }
+  if(!error && !ucvector_resize(&zlib, zlib.size + 4)) error = 83; /*alloc fail*/
+  if(!error) {
+    lodepng_set32bitInt(&zlib.data[zlib.size - 4], index.adler);
+    if(settings->custom_output) error = flushIDAT(&zlib, zlib.size, &stream);
+    else if(zlib.size > 2147483647u) error = 77; /*chunk too large*/
+    else error = lodepng_chunk_createv(out, (unsigned)zlib.size, "IDAT", zlib.data);
+  }
+  if(!error) error = lodepng_chunk_createv(out, (unsigned)index.entries.size, "loIX", index.entries.data);
+
+  lodepng_free(zlib.data);
+  lodepng_free(index.entries.data);
+  lodepng_free(stream.chunk.data);
+  return error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+/*loder extension: pass what has been encoded so far to the custom output, and empty the buffer*/
+static unsigned flushOutput(ucvector* out, const LodePNGEncoderSettings* settings) {
+  unsigned error = 0;
+  if(settings->custom_output && out->size > 0) {
+    error = settings->custom_output(out->data, out->size, settings->output_context);
+    out->size = 0;
+  }
+  return error;
+}
+
 static unsigned addChunk_IEND(ucvector* out) {
   return lodepng_chunk_createv(out, 0, "IEND", 0);
 }
@@ -6182,7 +8130,26 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
-    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
+#ifdef LODEPNG_COMPILE_ZLIB
+    if(state->encoder.restart_rows && info.interlace_method == 0 && !state->encoder.zlibsettings.custom_zlib &&
+       !state->encoder.zlibsettings.custom_deflate) {
+      /*loder extension: independent segments of rows, with an index to them*/
+      if(state->encoder.custom_output) state->error = flushOutput(&outv, &state->encoder);
+      if(state->error) goto cleanup;
+      state->error = addChunks_IDAT_indexed(&outv, data, datasize,
+                                            lodepng_get_raw_size_idat(w, 1, lodepng_get_bpp(&info.color)),
+                                            &state->encoder);
+    } else if(state->encoder.custom_output && !state->encoder.zlibsettings.custom_zlib &&
+              !state->encoder.zlibsettings.custom_deflate) {
+      /*everything so far goes out first, and then the image data as they are compressed*/
+      state->error = flushOutput(&outv, &state->encoder);
+      if(state->error) goto cleanup;
+      state->error = streamChunks_IDAT(data, datasize, &state->encoder);
+    } else
+#endif /*LODEPNG_COMPILE_ZLIB*/
+    {
+      state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
+    }
     if(state->error) goto cleanup;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*tIME*/
@@ -6250,6 +8217,8 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     state->error = addChunk_IEND(&outv);
     if(state->error) goto cleanup;
+    state->error = flushOutput(&outv, &state->encoder);
+    if(state->error) goto cleanup;
   }
 
 cleanup:
@@ -6257,6 +8226,12 @@ cleanup:
   lodepng_free(data);
   lodepng_color_mode_cleanup(&auto_color);
 
+  /*all output has been passed on, or abandoned after an error*/
+  if(state->encoder.custom_output) {
+    lodepng_free(outv.data);
+    outv = ucvector_init(NULL, 0);
+  }
+
   /*instead of cleaning the vector up, give it to the output*/
   *out = outv.data;
   *outsize = outv.size;
@@ -6318,6 +8293,9 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings) {
   settings->add_id = 0;
   settings->text_compression = 1;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  settings->custom_output = 0;
+  settings->output_context = 0;
+  settings->restart_rows = 0;
 }
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -305,6 +305,16 @@ unsigned encode(const std::string& filename,
 const char* lodepng_error_text(unsigned code);
 #endif /*LODEPNG_COMPILE_ERROR_TEXT*/
 
+/*loder extension: memory kept from one call of the encoder or decoder to the next, rather than being
+allocated and initialised afresh each time, which matters when many small images are processed in turn.
+The encoder keeps its LZ77 hash tables here, and the decoder its buffer of decompressed image data. Set
+it as the workspace of the compress settings or decoder settings. A workspace may be used by any number
+of calls, but only one at a time.*/
+typedef struct LodePNGWorkspace LodePNGWorkspace;
+/*returns NULL if out of memory*/
+LodePNGWorkspace* lodepng_workspace_new(void);
+void lodepng_workspace_free(LodePNGWorkspace* workspace);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*Settings for zlib decompression*/
 typedef struct LodePNGDecompressSettings LodePNGDecompressSettings;
@@ -333,6 +343,26 @@ struct LodePNGDecompressSettings {
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*loder extension: if nonzero, the built in decoder stops without error once at least this many bytes
+  have been decompressed, so that only the start of a stream need be inflated. The output may be somewhat
+  longer than this, and the Adler32 checksum is not checked when stopping early. Default: 0*/
+  size_t stop_output_size;
+
+  /*loder extension: if set, the built in decoder calls this function with the size of the output when it
+  starts, and again whenever the output has grown to at least the size returned by the previous call, until
+  that is 0. The output buffer may move between calls unless enough room was reserved in advance, and
+  the decoder then fails rather than outgrow it if max_output_size is also set. Default: NULL*/
+  size_t (*progress)(size_t size, void* context);
+  void* progress_context; /*passed to the progress function*/
+
+  /*loder extension: if nonzero, the built in decoder keeps only the end of the output once the progress
+  function has seen it: after a call, once the buffer holds at least twice window_size bytes (or 32768, the
+  reach of deflate, if more), all but the last window_size are discarded from its start, so that its size
+  stays bounded however long the stream. The sizes passed to the progress function and compared with
+  max_output_size and stop_output_size still count all of the output, and the Adler32 checksum still
+  covers it. Default: 0*/
+  size_t window_size;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -366,6 +396,16 @@ struct LodePNGCompressSettings /*deflate = compress*/ {
                              const LodePNGCompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*loder extension: if set, the built in encoder reuses the hash tables kept in this workspace. Default: NULL*/
+  LodePNGWorkspace* workspace;
+
+  /*loder extension: if greater than 1, and OpenMP is available, the built in encoder splits large inputs
+  into segments that are compressed concurrently by up to this many threads, each primed with the data
+  before it so that matches can reach back across the join. The result is a single standard zlib
+  stream, a little larger than otherwise, and the same for any number of threads above 1. The workspace
+  is not used in this case. Default: 0*/
+  unsigned threads;
 };
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
@@ -738,6 +778,34 @@ typedef struct LodePNGDecoderSettings {
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*loder extension: if nonzero, decode at most this many rows of a non-interlaced image, decompressing
+  and unfiltering no further than that; the returned height is then the number of rows decoded.
+  Interlaced images are unaffected. Default: 0*/
+  unsigned max_rows;
+
+  /*loder extension: if 1, 3 or 5, decode only that many Adam7 passes of an interlaced image, which form
+  the image reduced by a factor of 8, 4 or 2 in each dimension, and decompress no further. The returned
+  width and height are those of the reduced image. Non-interlaced images are unaffected. Default: 0*/
+  unsigned adam7_passes;
+
+  /*loder extension: if set, the decompressed scanlines are held in a buffer kept in this workspace,
+  which grows as needed and is not freed after decoding. Default: NULL*/
+  LodePNGWorkspace* workspace;
+
+  /*loder extension: if set, the rows of a non-interlaced image are passed to this function in batches of
+  consecutive rows as soon as they are unfiltered, rather than returned, and no colour conversion is done.
+  The rows are in the colour type of the PNG, each starting at a byte boundary. A nonzero return value is
+  an error code, and fails the decode. Interlaced images, and any decompressed with custom_zlib or
+  custom_inflate, are returned as usual. Default: NULL*/
+  unsigned (*row_callback)(const unsigned char* rows, unsigned first, unsigned count, void* context);
+  void* row_context; /*passed to the row callback*/
+
+  /*loder extension: with a row callback and OpenMP, the number of threads over which to spread the work:
+  one decompresses, another unfilters the rows behind it, and any others call the row callback
+  concurrently, for different batches of rows. If the image has a loIX chunk, as written with
+  restart_rows, all of the threads first decompress its segments concurrently. Default: 1*/
+  unsigned threads;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
 
@@ -844,6 +912,20 @@ typedef struct LodePNGEncoderSettings {
   /*encode text chunks as zTXt chunks instead of tEXt chunks, and use compression in iTXt chunks*/
   unsigned text_compression;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  /*loder extension: if set, the encoded file is passed to this function piece by piece as it is
+  produced, rather than being accumulated in memory, and lodepng_encode gives no output of its own.
+  The image data are split into IDAT chunks as each deflate block is completed, so the memory used
+  no longer depends on the size of the compressed data. A nonzero return value aborts encoding and
+  is used as the error code. Not used if custom_zlib or custom_deflate is set. Default: NULL*/
+  unsigned (*custom_output)(const unsigned char* data, size_t size, void* context);
+  void* output_context; /*optional context passed to custom_output*/
+  /*loder extension: if set, the image data of a non-interlaced image are compressed as independent
+  segments of this many rows, each starting on a byte boundary with nothing referring back before it,
+  and a private loIX chunk after the IDAT chunks gives the offset of each segment in the zlib stream and
+  the Adler-32 of the data before it, so that a decoder can decompress the segments concurrently. The
+  file remains a standard PNG. Segments are compressed concurrently if zlibsettings.threads is above 1.
+  Not used if custom_zlib or custom_deflate is set. Default: 0*/
+  unsigned restart_rows;
 } LodePNGEncoderSettings;
 
 void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings);
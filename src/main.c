@@ -3,239 +3,1542 @@
 #include <R.h>
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
+#include <Rversion.h>
+
+// Lazily decoded images are ALTREP vectors, and ALTREP raw vectors need R 3.6.0
+#if defined(R_VERSION) && R_VERSION >= R_Version(3,6,0)
+#define LAZY_IMAGES
+#include <R_ext/Altrep.h>
+#endif
 
 #include "lodepng.h"
+#include "deinterleave.h"
+#include "interleave.h"
+#include "downscale.h"
+#include "mapfile.h"
+
+// Predefined compression levels
+// Elements are block type, use LZ77, window size, minimum LZ77 length, threshold length to stop searching, use lazy matching
+// The remaining elements are for custom hooks, a workspace and a thread count, which are set per call if at all
+const LodePNGCompressSettings level0 = { 0, 0,  2048, 3,  16, 0, 0, 0, 0, 0, 0 };  // No compression
+const LodePNGCompressSettings level1 = { 1, 1,   256, 3,  32, 1, 0, 0, 0, 0, 0 };  // Fixed Huffman tree, small window
+const LodePNGCompressSettings level2 = { 1, 1,  1024, 3,  64, 1, 0, 0, 0, 0, 0 };  // Fixed Huffman tree, medium window
+const LodePNGCompressSettings level3 = { 2, 1,  1024, 3,  64, 1, 0, 0, 0, 0, 0 };  // Dynamic tree, medium window
+const LodePNGCompressSettings level4 = { 2, 1,  2048, 3, 128, 1, 0, 0, 0, 0, 0 };  // LodePNG defaults
+const LodePNGCompressSettings level5 = { 2, 1,  8192, 3, 128, 1, 0, 0, 0, 0, 0 };  // Dynamic tree, large window
+const LodePNGCompressSettings level6 = { 2, 1, 32768, 3, 258, 1, 0, 0, 0, 0, 0 };  // Maximum compression
+
+// Work out the number of channels in the decoded image, given the colour type of the file
+static unsigned png_channels (const LodePNGColorMode *color)
+{
+    switch (color->colortype)
+    {
+        case LCT_GREY:          return 1;
+        case LCT_GREY_ALPHA:    return 2;
+        case LCT_RGB:           return 3;
+        case LCT_PALETTE:
+        case LCT_RGBA:          return 4;
+        default:                return 0;
+    }
+}
+
+// The amount of the end of a file read at once to find any chunks after the image data
+#define TAIL_SIZE 65536L
+
+// Whether four bytes are a plausible chunk type, made up of ASCII letters
+static Rboolean valid_chunk_type (const unsigned char *type)
+{
+    for (int i=0; i<4; i++)
+    {
+        if ((type[i] | 32) < 'a' || (type[i] | 32) > 'z')
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Make sure that a buffer can hold the given number of bytes, doubling its capacity as necessary
+static Rboolean reserve_buffer (unsigned char **buffer, size_t *capacity, const size_t size)
+{
+    if (size <= *capacity)
+        return TRUE;
+    
+    size_t new_capacity = *capacity;
+    while (size > new_capacity)
+        new_capacity *= 2;
+    unsigned char *new_buffer = (unsigned char *) realloc(*buffer, new_capacity);
+    if (new_buffer == NULL)
+        return FALSE;
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return TRUE;
+}
+
+// Find the chunks between the image data and the end of a file, given the offset just
+// past the first IDAT chunk, and append them to the buffer. They are found in a single
+// read from the end of the file, by working back from IEND through chunks whose lengths
+// and CRCs match, until reaching the image data. Returns FALSE, with the file position
+// unchanged, if they aren't all within reach, such as when the file is truncated
+static Rboolean load_trailing_chunks (FILE *file, const long data_end, const long size, unsigned char **buffer, size_t *used, size_t *capacity)
+{
+    const long position = ftell(file);
+    const long start = (size - data_end > TAIL_SIZE ? size - TAIL_SIZE : data_end);
+    if (position < 0 || data_end > size || size - start < 12)
+        return FALSE;
+    
+    const size_t tail_size = (size_t) (size - start);
+    unsigned char *tail = (unsigned char *) malloc(tail_size);
+    if (tail == NULL)
+        return FALSE;
+    
+    // The last IEND chunk ends the PNG data, although anything may follow it
+    size_t end = tail_size - 12;
+    Rboolean found = (fseek(file, start, SEEK_SET) == 0 && fread(tail, 1, tail_size, file) == tail_size);
+    while (found && (memcmp(tail + end, "\0\0\0\0IEND", 8) != 0 || lodepng_chunk_check_crc(tail + end)))
+        found = (end-- > 0);
+    
+    // Each chunk ends where the next begins, so search backwards from the earliest found so
+    // far for one whose length and CRC fit, until reaching either IDAT or the first IDAT's end
+    size_t first = end;
+    while (found && start + (long) first != data_end)
+    {
+        size_t chunk = (first >= 12 ? first - 11 : 0);
+        found = FALSE;
+        while (!found && chunk > 0)
+        {
+            chunk--;
+            found = ((size_t) lodepng_chunk_length(tail + chunk) == first - chunk - 12 && valid_chunk_type(tail + chunk + 4) && !lodepng_chunk_check_crc(tail + chunk));
+        }
+        if (found && lodepng_chunk_type_equals(tail + chunk, "IDAT"))
+            break;
+        first = chunk;
+    }
+    
+    // The chunks found are contiguous, and already in file order
+    if (found && reserve_buffer(buffer, capacity, *used + end + 12 - first))
+    {
+        memcpy(*buffer + *used, tail + first, end + 12 - first);
+        *used += end + 12 - first;
+    }
+    else
+        found = FALSE;
+    
+    free(tail);
+    if (!found)
+        fseek(file, position, SEEK_SET);
+    return found;
+}
+
+// Read every chunk of a PNG file except the image data into memory
+// IDAT chunks are skipped over, so their contents are never read
+static unsigned load_png_metadata (unsigned char **out, size_t *out_size, size_t *file_size, const char *filename)
+{
+    unsigned error = 0;
+    unsigned char header[8];
+    unsigned char *buffer;
+    size_t capacity = 1024, used = 0;
+    long size;
+    Rboolean seen_data = FALSE;
+    
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 78;
+    
+    // The file size is reported, but only the chunk headers are needed to walk the file
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || size == LONG_MAX || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return 78;
+    }
+    *file_size = (size_t) size;
+    
+    // No buffering, so that skipping IDAT chunks doesn't read any of their data
+    setvbuf(file, NULL, _IONBF, 0);
+    
+    buffer = (unsigned char *) malloc(capacity);
+    if (buffer == NULL)
+    {
+        fclose(file);
+        return 83;
+    }
+    
+    // Check the signature before trying to interpret anything else as a chunk
+    used = fread(buffer, 1, 8, file);
+    if (used == 8 && memcmp(buffer, "\x89PNG\r\n\x1a\n", 8) != 0)
+        error = 28;
+    
+    while (!error && used >= 8)
+    {
+        if (fread(header, 1, 8, file) != 8)
+            break;
+        
+        const unsigned length = lodepng_chunk_length(header);
+        if (length > 2147483647)
+        {
+            error = 63;
+            break;
+        }
+        
+        if (lodepng_chunk_type_equals(header, "IDAT"))
+        {
+            // Any chunks after the image data can usually be found from the end of the file, in
+            // which case we are done; otherwise the IDAT chunks are skipped one by one
+            if (!seen_data)
+            {
+                const long position = ftell(file);
+                seen_data = TRUE;
+                if (position >= 0 && length + 4 <= size - position && load_trailing_chunks(file, position + (long) length + 4, size, &buffer, &used, &capacity))
+                    break;
+            }
+            
+            // Skip the data and CRC (in two steps, since long may be 32-bit)
+            if (fseek(file, (long) length, SEEK_CUR) != 0 || fseek(file, 4L, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+        
+        if (!reserve_buffer(&buffer, &capacity, used + length + 12))
+        {
+            error = 83;
+            break;
+        }
+        
+        // Truncation is an error before the image data, but anything after it is optional
+        memcpy(buffer + used, header, 8);
+        if (fread(buffer + used + 8, 1, length + 4, file) != length + 4)
+        {
+            if (!seen_data)
+                error = 30;
+            break;
+        }
+        used += length + 12;
+        
+        if (lodepng_chunk_type_equals(header, "IEND"))
+            break;
+    }
+    
+    fclose(file);
+    
+    if (error)
+    {
+        free(buffer);
+        return error;
+    }
+    
+    *out = buffer;
+    *out_size = used;
+    return 0;
+}
+
+// Interpret every chunk of an in-memory file after the header, in file order, so
+// that PLTE comes before tRNS and bKGD; image data chunks are passed over
+static unsigned inspect_chunks (LodePNGState *state, const unsigned char *png, const size_t png_size)
+{
+    unsigned error = 0;
+    const unsigned char *chunk, *end = png + png_size;
+    for (chunk = png + 8; !error && chunk + 12 <= end; chunk = lodepng_chunk_next_const(chunk, end))
+        error = lodepng_inspect_chunk(state, (size_t) (chunk - png), png, png_size);
+    return error;
+}
+
+// Format the background colour of an image as a six-digit hex code, returning zero if there isn't one
+// For palette images, LodePNG gives the palette index of the colour
+static int format_background (char *background, const LodePNGInfo *info)
+{
+    if (!info->background_defined)
+        return 0;
+    else if (info->color.colortype == LCT_PALETTE)
+    {
+        if (info->background_r >= info->color.palettesize)
+            return 0;
+        const unsigned char *entry = info->color.palette + 4 * info->background_r;
+        snprintf(background, 8, "#%02X%02X%02X", entry[0], entry[1], entry[2]);
+    }
+    else
+    {
+        // Other images give sample values at the bit depth of the image, which are scaled to 8 bits
+        const unsigned bitdepth = info->color.bitdepth;
+        unsigned rgb[3] = { info->background_r, info->background_g, info->background_b };
+        for (int i=0; i<3; i++)
+            rgb[i] = (bitdepth == 16 ? rgb[i] >> 8 : (bitdepth < 8 ? rgb[i] * 255 / ((1u << bitdepth) - 1) : rgb[i])) & 0xff;
+        snprintf(background, 8, "#%02X%02X%02X", rgb[0], rgb[1], rgb[2]);
+    }
+    return 1;
+}
+
+// Attach attributes that are common to full images and metadata-only objects
+static void set_metadata (SEXP image, const LodePNGInfo *info)
+{
+    SEXP asp, dpi, pixdim, text_keys, text_vals;
+    char background[8] = "";
+    
+    // If a background colour is defined in the file, convert it to a hex code and store it
+    if (format_background(background, info))
+    {
+        Rf_setAttrib(image, Rf_install("background"), PROTECT(Rf_mkString(background)));
+        UNPROTECT(1);
+    }
+    
+    // Set the aspect ratio or DPI/pixel size if available
+    if (info->phys_defined)
+    {
+        if (info->phys_unit == 0)
+        {
+            PROTECT(asp = Rf_allocVector(REALSXP,1));
+            *REAL(asp) = (double) info->phys_y / (double) info->phys_x;
+            Rf_setAttrib(image, Rf_install("asp"), asp);
+            UNPROTECT(1);
+        }
+        else
+        {
+            PROTECT(dpi = Rf_allocVector(REALSXP,2));
+            PROTECT(pixdim = Rf_allocVector(REALSXP,2));
+            REAL(dpi)[0] = (double) info->phys_x / 39.3700787402;
+            REAL(dpi)[1] = (double) info->phys_y / 39.3700787402;
+            REAL(pixdim)[0] = 1000.0 / (double) info->phys_x;
+            REAL(pixdim)[1] = 1000.0 / (double) info->phys_y;
+            Rf_setAttrib(image, Rf_install("dpi"), dpi);
+            Rf_setAttrib(image, Rf_install("pixdim"), pixdim);
+            Rf_setAttrib(image, Rf_install("pixunits"), PROTECT(Rf_mkString("mm")));
+            UNPROTECT(3);
+        }
+    }
+    
+    // Convert text chunks
+    if (info->itext_num > 0)
+    {
+        PROTECT(text_keys = Rf_allocVector(STRSXP, info->itext_num + info->text_num));
+        PROTECT(text_vals = Rf_allocVector(STRSXP, info->itext_num + info->text_num));
+        
+        for (size_t i=0; i<info->itext_num; i++)
+        {
+            SET_STRING_ELT(text_keys, i, Rf_mkCharCE(info->itext_transkeys[i], CE_UTF8));
+            SET_STRING_ELT(text_vals, i, Rf_mkCharCE(info->itext_strings[i], CE_UTF8));
+        }
+        for (size_t i=0; i<info->text_num; i++)
+        {
+            SET_STRING_ELT(text_keys, i+info->itext_num, Rf_mkChar(info->text_keys[i]));
+            SET_STRING_ELT(text_vals, i+info->itext_num, Rf_mkChar(info->text_strings[i]));
+        }
+        
+        Rf_setAttrib(text_vals, R_NamesSymbol, text_keys);
+        Rf_setAttrib(image, Rf_install("text"), text_vals);
+        UNPROTECT(2);
+    }
+    else if (info->text_num > 0)
+    {
+        PROTECT(text_keys = Rf_allocVector(STRSXP, info->text_num));
+        PROTECT(text_vals = Rf_allocVector(STRSXP, info->text_num));
+        
+        for (size_t i=0; i<info->text_num; i++)
+        {
+            SET_STRING_ELT(text_keys, i, Rf_mkChar(info->text_keys[i]));
+            SET_STRING_ELT(text_vals, i, Rf_mkChar(info->text_strings[i]));
+        }
+        
+        Rf_setAttrib(text_vals, R_NamesSymbol, text_keys);
+        Rf_setAttrib(image, Rf_install("text"), text_vals);
+        UNPROTECT(2);
+    }
+}
+
+// A single metadata-reading task, which can be completed without touching the R API
+typedef struct {
+    const char *filename;
+    size_t file_size;
+    unsigned width, height, channels;
+    unsigned error;
+    LodePNGState state;
+} inspect_job;
+
+// Read and interpret the metadata chunks of one file
+// This is called from worker threads, so must not call any R API function
+static void inspect_file (inspect_job *job)
+{
+    unsigned char *png = NULL;
+    size_t png_size;
+    
+    lodepng_state_init(&job->state);
+    job->channels = 0;
+    
+    // Read the file into memory, omitting the image data
+    job->error = load_png_metadata(&png, &png_size, &job->file_size, job->filename);
+    
+    // Read basic metadata from the IHDR chunk, and then the remaining chunks
+    if (!job->error)
+        job->error = lodepng_inspect(&job->width, &job->height, &job->state, png, png_size);
+    if (!job->error)
+        job->error = inspect_chunks(&job->state, png, png_size);
+    if (!job->error)
+        job->channels = png_channels(&job->state.info_png.color);
+    
+    free(png);
+}
+
+SEXP inspect_png (SEXP file_)
+{
+    inspect_job job;
+    SEXP image;
+    
+    job.filename = CHAR(STRING_ELT(file_, 0));
+    inspect_file(&job);
+    
+    if (job.error)
+    {
+        const unsigned error = job.error;
+        lodepng_state_cleanup(&job.state);
+        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+    }
+    
+    const LodePNGInfo *info = &job.state.info_png;
+    if (job.channels == 0)
+    {
+        lodepng_state_cleanup(&job.state);
+        Rf_error("Unexpected colour type");
+    }
+    
+    // We don't need the data, so just return the input vector with attributes
+    PROTECT(image = Rf_duplicate(file_));
+    
+    // Set the object class and other basic attributes
+    Rf_setAttrib(image, R_ClassSymbol, PROTECT(Rf_mkString("lodermeta")));
+    Rf_setAttrib(image, Rf_install("width"), PROTECT(Rf_ScalarInteger(job.width)));
+    Rf_setAttrib(image, Rf_install("height"), PROTECT(Rf_ScalarInteger(job.height)));
+    Rf_setAttrib(image, Rf_install("channels"), PROTECT(Rf_ScalarInteger(job.channels)));
+    Rf_setAttrib(image, Rf_install("bitdepth"), PROTECT(Rf_ScalarInteger(info->color.bitdepth)));
+    Rf_setAttrib(image, Rf_install("filesize"), PROTECT(Rf_ScalarReal((double) job.file_size)));
+    Rf_setAttrib(image, Rf_install("interlaced"), PROTECT(Rf_ScalarLogical(info->interlace_method)));
+    
+    // If a palette is used, capture the number of colours
+    if (info->color.colortype == LCT_PALETTE)
+    {
+        Rf_setAttrib(image, Rf_install("palette"), PROTECT(Rf_ScalarInteger((int) info->color.palettesize)));
+        UNPROTECT(1);
+    }
+    
+    UNPROTECT(7);
+    
+    set_metadata(image, info);
+    
+    // Tidy up
+    lodepng_state_cleanup(&job.state);
+    
+    UNPROTECT(1);
+    return image;
+}
+
+// Inspect many files at once, returning a data frame with one row per file
+SEXP inspect_png_batch (SEXP file_, SEXP threads_)
+{
+    static const char *names[] = { "file", "width", "height", "channels", "bitdepth", "interlaced", "palette", "filesize", "xdpi", "ydpi", "asp", "background" };
+    const R_len_t n_files = Rf_length(file_);
+    int threads = Rf_asInteger(threads_);
+    SEXP result, column_names, row_names;
+    
+    if (threads == NA_INTEGER || threads < 1)
+        threads = 1;
+    
+    // Allocate the columns up front
+    PROTECT(result = Rf_allocVector(VECSXP, 12));
+    SET_VECTOR_ELT(result, 0, Rf_duplicate(file_));
+    for (int k=1; k<=6; k++)
+        SET_VECTOR_ELT(result, k, Rf_allocVector(k == 5 ? LGLSXP : INTSXP, n_files));
+    for (int k=7; k<=10; k++)
+        SET_VECTOR_ELT(result, k, Rf_allocVector(REALSXP, n_files));
+    SET_VECTOR_ELT(result, 11, Rf_allocVector(STRSXP, n_files));
+    
+    const R_len_t batch_size = (n_files < 16 * threads ? n_files : 16 * threads);
+    inspect_job *jobs = (inspect_job *) R_alloc(batch_size > 0 ? batch_size : 1, sizeof(inspect_job));
+    
+    for (R_len_t start=0; start<n_files; start+=batch_size)
+    {
+        const R_len_t end = (start + batch_size < n_files ? start + batch_size : n_files);
+        
+        for (R_len_t i=start; i<end; i++)
+            jobs[i-start].filename = CHAR(STRING_ELT(file_, i));
+        
+        // Read the metadata concurrently
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+        for (R_len_t i=start; i<end; i++)
+            inspect_file(&jobs[i-start]);
+        
+        for (R_len_t i=start; i<end; i++)
+        {
+            const inspect_job *job = &jobs[i-start];
+            if (job->error || job->channels == 0)
+            {
+                const unsigned error = job->error;
+                const char *filename = job->filename;
+                for (R_len_t j=start; j<end; j++)
+                    lodepng_state_cleanup(&jobs[j-start].state);
+                if (error)
+                    Rf_error("LodePNG error in file \"%s\": %s\n", filename, lodepng_error_text(error));
+                else
+                    Rf_error("Unexpected colour type in file \"%s\"", filename);
+            }
+        }
+        
+        // Fill in the columns, with missing values where the information is absent from the file
+        for (R_len_t i=start; i<end; i++)
+        {
+            inspect_job *job = &jobs[i-start];
+            const LodePNGInfo *info = &job->state.info_png;
+            char background[8] = "";
+            
+            INTEGER(VECTOR_ELT(result, 1))[i] = job->width;
+            INTEGER(VECTOR_ELT(result, 2))[i] = job->height;
+            INTEGER(VECTOR_ELT(result, 3))[i] = job->channels;
+            INTEGER(VECTOR_ELT(result, 4))[i] = info->color.bitdepth;
+            LOGICAL(VECTOR_ELT(result, 5))[i] = info->interlace_method;
+            INTEGER(VECTOR_ELT(result, 6))[i] = (info->color.colortype == LCT_PALETTE ? (int) info->color.palettesize : NA_INTEGER);
+            REAL(VECTOR_ELT(result, 7))[i] = (double) job->file_size;
+            REAL(VECTOR_ELT(result, 8))[i] = (info->phys_defined && info->phys_unit != 0 ? (double) info->phys_x / 39.3700787402 : NA_REAL);
+            REAL(VECTOR_ELT(result, 9))[i] = (info->phys_defined && info->phys_unit != 0 ? (double) info->phys_y / 39.3700787402 : NA_REAL);
+            REAL(VECTOR_ELT(result, 10))[i] = (info->phys_defined && info->phys_unit == 0 ? (double) info->phys_y / (double) info->phys_x : NA_REAL);
+            if (format_background(background, info))
+                SET_STRING_ELT(VECTOR_ELT(result, 11), i, Rf_mkChar(background));
+            else
+                SET_STRING_ELT(VECTOR_ELT(result, 11), i, NA_STRING);
+            
+            lodepng_state_cleanup(&job->state);
+        }
+        
+        R_CheckUserInterrupt();
+    }
+    
+    PROTECT(column_names = Rf_allocVector(STRSXP, 12));
+    for (int k=0; k<12; k++)
+        SET_STRING_ELT(column_names, k, Rf_mkChar(names[k]));
+    Rf_setAttrib(result, R_NamesSymbol, column_names);
+    
+    // Compact row names, as used by R itself
+    PROTECT(row_names = Rf_allocVector(INTSXP, 2));
+    INTEGER(row_names)[0] = NA_INTEGER;
+    INTEGER(row_names)[1] = -n_files;
+    Rf_setAttrib(result, R_RowNamesSymbol, row_names);
+    Rf_setAttrib(result, R_ClassSymbol, PROTECT(Rf_mkString("data.frame")));
+    
+    UNPROTECT(4);
+    return result;
+}
+
+// Error code for a band of rows that doesn't fit within the image, beyond LodePNG's own codes
+#define ROWS_ERROR 1000
+
+static const char * decode_error_text (const unsigned error)
+{
+    return (error == ROWS_ERROR ? "requested rows are outside the image" : lodepng_error_text(error));
+}
+
+// A single decoding task, which can be completed without touching the R API
+// The encoded data come from a file, or from a buffer owned by someone else
+// Lazy jobs only interpret the metadata, and keep the contents of a file as "encoded"
+// The image is reduced by the scale factor in each dimension, and then nonzero
+// first and last rows, counting from one, select a band of the result
+// Indexed jobs return the palette indices of palette images, as a single channel
+typedef struct {
+    const char *filename;
+    const unsigned char *buffer;
+    size_t buffer_size;
+    Rboolean lazy, indexed;
+    unsigned scale, first_row, last_row;
+    LodePNGWorkspace *workspace;
+    file_contents encoded;
+    unsigned char *data;
+    unsigned width, height, channels;
+    unsigned error;
+    LodePNGState state;
+} decode_job;
+
+// Unpack palette indices of fewer than eight bits, packed without padding, into one byte each
+static void unpack_indices_into (unsigned char *indices, const unsigned char *data, const size_t n, const unsigned bitdepth)
+{
+    const unsigned per_byte = 8 / bitdepth, mask = (1u << bitdepth) - 1;
+    for (size_t l=0; l<n; l++)
+        indices[l] = (data[l / per_byte] >> (8 - bitdepth * (l % per_byte + 1))) & mask;
+}
+
+// The same for a whole image, which LodePNG returns without padding between rows
+static unsigned char * unpack_indices (const unsigned char *data, const size_t n, const unsigned bitdepth)
+{
+    unsigned char *indices = (unsigned char *) malloc(n);
+    if (indices != NULL)
+        unpack_indices_into(indices, data, n, bitdepth);
+    return indices;
+}
+
+// Map the file for a decode job into memory, unless the data are already there, and
+// read the image header, setting the error code on failure
+// The caller is responsible for unmapping the file
+static void open_job (decode_job *job, file_contents *file, const unsigned char **png, size_t *png_size)
+{
+    job->data = NULL;
+    job->encoded = *file;
+    lodepng_state_init(&job->state);
+    job->state.decoder.workspace = job->workspace;
+    
+    if (job->buffer != NULL)
+    {
+        *png = job->buffer;
+        *png_size = job->buffer_size;
+        job->error = 0;
+    }
+    else
+    {
+        // Decoding straight from a memory map avoids copying the whole file onto the heap
+        job->error = map_file(file, job->filename);
+        *png = file->data;
+        *png_size = file->size;
+    }
+    
+    // Read basic metadata from the image blob, and figure out the number of channels
+    if (!job->error)
+        job->error = lodepng_inspect(&job->width, &job->height, &job->state, *png, *png_size);
+    if (!job->error)
+    {
+        job->indexed = (job->indexed && job->state.info_png.color.colortype == LCT_PALETTE);
+        job->channels = (job->indexed ? 1 : png_channels(&job->state.info_png.color));
+    }
+    if (!job->error && job->last_row > (job->height + job->scale - 1) / job->scale)
+        job->error = ROWS_ERROR;
+}
+
+// Fewer pixels cover the same physical extent, so the resolution drops by the scale factor
+// The aspect ratio alone, if that's all we have, is unaffected
+static void scale_resolution (decode_job *job)
+{
+    LodePNGInfo *info = &job->state.info_png;
+    if (job->scale > 1 && info->phys_defined && info->phys_unit != 0)
+    {
+        info->phys_x = (info->phys_x > job->scale ? (info->phys_x + job->scale / 2) / job->scale : 1);
+        info->phys_y = (info->phys_y > job->scale ? (info->phys_y + job->scale / 2) / job->scale : 1);
+    }
+}
+
+// Read and decode one file or buffer into 8-bit interleaved data
+// This is called from worker threads, so must not call any R API function
+static void decode_file (decode_job *job)
+{
+    file_contents file = { NULL, 0, 0 };
+    const unsigned char *png;
+    size_t png_size;
+    
+    open_job(job, &file, &png, &png_size);
+    
+    if (!job->error && job->lazy)
+    {
+        // Interpret the other metadata chunks, and hang on to the file contents for decoding later
+        job->error = inspect_chunks(&job->state, png, png_size);
+        if (!job->error)
+        {
+            job->encoded = file;
+            file.data = NULL;
+            job->width = (job->width + job->scale - 1) / job->scale;
+            if (job->first_row > 0)
+                job->height = job->last_row - job->first_row + 1;
+            else
+                job->height = (job->height + job->scale - 1) / job->scale;
+        }
+    }
+    else if (!job->error)
+    {
+        // Interlaced images are reduced by decoding only the early passes, which gives
+        // a subsample of the pixels; others are decoded in full and then box-filtered
+        unsigned factor = job->scale;
+        if (job->state.info_png.interlace_method == 1 && factor > 1)
+        {
+            job->state.decoder.adam7_passes = (factor == 8 ? 1 : (factor == 4 ? 3 : 5));
+            factor = 1;
+        }
+        
+        // Set the required colour type and bit depth, and decode the blob
+        // Palette indices need no conversion, although they may be packed into fewer than eight bits
+        // LodePNG stops decompressing after the last requested row, unless the image is interlaced
+        job->state.info_raw.colortype = (job->state.info_png.color.colortype == LCT_PALETTE ? LCT_RGBA : job->state.info_png.color.colortype);
+        job->state.info_raw.bitdepth = 8;
+        job->state.decoder.color_convert = !job->indexed;
+        job->state.decoder.max_rows = job->last_row * factor;
+        job->error = lodepng_decode(&job->data, &job->width, &job->height, &job->state, png, png_size);
+        
+        if (!job->error && job->indexed && job->state.info_png.color.bitdepth < 8)
+        {
+            unsigned char *indices = unpack_indices(job->data, (size_t) job->width * job->height, job->state.info_png.color.bitdepth);
+            if (indices == NULL)
+                job->error = 83;
+            free(job->data);
+            job->data = indices;
+        }
+        
+        // Move the rows covering the requested band to the start of the buffer
+        if (!job->error && job->first_row > 0)
+        {
+            const size_t row_size = (size_t) job->width * job->channels;
+            const unsigned start = (job->first_row - 1) * factor;
+            const unsigned end = (job->last_row * factor < job->height ? job->last_row * factor : job->height);
+            job->height = end - start;
+            memmove(job->data, job->data + start * row_size, job->height * row_size);
+        }
+        
+        // Indices can't be averaged, so are subsampled instead, like interlaced images
+        if (!job->error && factor > 1)
+        {
+            if (job->indexed)
+                subsample(job->data, job->width, job->height, job->channels, factor);
+            else
+                job->error = downscale(job->data, job->width, job->height, job->channels, factor);
+            job->width = (job->width + factor - 1) / factor;
+            job->height = (job->height + factor - 1) / factor;
+        }
+    }
+    
+    if (!job->error)
+        scale_resolution(job);
+    
+    if (file.data != NULL)
+        unmap_file(&file);
+}
+
+static void free_decode_job (decode_job *job)
+{
+    lodepng_state_cleanup(&job->state);
+    free(job->data);
+    job->data = NULL;
+    if (job->encoded.data != NULL)
+        unmap_file(&job->encoded);
+}
+
+// Where LodePNG's row callback should put the rows of a pipelined decode: the
+// array of the final image, which is missing the first "skip" rows of the file
+// A reduced image is built from boxes of "factor" rows and columns, the last of
+// which ends before row "end", and the box sums for the current row of the
+// result are kept in "sums", with the number of rows added so far in "boxed"
+typedef struct {
+    const decode_job *job;
+    int *image_int;
+    unsigned char *image_raw;
+    unsigned width, skip, end, factor, boxed;
+    unsigned *sums;
+} row_sink;
+
+// Drop any rows of a batch above the band, which are needed for unfiltering those
+// below but are not kept, returning zero if none are left
+static unsigned skip_rows (const row_sink *sink, const unsigned char **rows, unsigned *first, unsigned *count)
+{
+    if (*first + *count <= sink->skip)
+        return 0;
+    else if (*first < sink->skip)
+    {
+        *rows += (sink->skip - *first) * lodepng_get_raw_size(sink->width, 1, &sink->job->state.info_png.color);
+        *count -= sink->skip - *first;
+        *first = sink->skip;
+    }
+    return *count;
+}
+
+// Convert a batch of unfiltered rows to 8-bit samples, or to one byte per index, if they
+// aren't already, setting the data pointer to any buffer allocated for the result
+// Returns zero or a LodePNG error code
+static unsigned convert_rows (const row_sink *sink, const unsigned char **rows, const unsigned count, unsigned char **data)
+{
+    const decode_job *job = sink->job;
+    const LodePNGColorMode *color = &job->state.info_png.color;
+    const unsigned width = sink->width;
+    const size_t row_bytes = lodepng_get_raw_size(width, 1, color), row_size = (size_t) width * job->channels;
+    
+    // Rows of 8-bit samples, or indices, are already as needed; others are converted one by one
+    *data = NULL;
+    if (color->bitdepth == 8 && (color->colortype != LCT_PALETTE || job->indexed))
+        return 0;
+    
+    *data = (unsigned char *) malloc(count * row_size);
+    if (*data == NULL)
+        return 83;
+    for (unsigned i=0; i<count; i++)
+    {
+        if (job->indexed)
+            unpack_indices_into(*data + i * row_size, *rows + i * row_bytes, width, color->bitdepth);
+        else
+        {
+            const unsigned error = lodepng_convert(*data + i * row_size, *rows + i * row_bytes, &job->state.info_raw, color, width, 1);
+            if (error)
+            {
+                free(*data);
+                *data = NULL;
+                return error;
+            }
+        }
+    }
+    *rows = *data;
+    return 0;
+}
+
+// Convert a batch of unfiltered rows, and write them into the R array, whose
+// data pointer was fetched beforehand
+// This is called from worker threads, concurrently for different rows
+static unsigned sink_rows (const unsigned char *rows, unsigned first, unsigned count, void *context)
+{
+    const row_sink *sink = (const row_sink *) context;
+    const decode_job *job = sink->job;
+    unsigned char *data;
+    
+    if (skip_rows(sink, &rows, &first, &count) == 0)
+        return 0;
+    const unsigned error = convert_rows(sink, &rows, count, &data);
+    if (error)
+        return error;
+    
+    if (sink->image_int != NULL)
+        deinterleave_rows_int(sink->image_int, rows, job->width, job->height, job->channels, first - sink->skip, count);
+    else
+        deinterleave_rows_raw(sink->image_raw, rows, job->width, job->height, job->channels, first - sink->skip, count);
+    free(data);
+    return 0;
+}
+
+// Reduce a batch of unfiltered rows by the scale factor as they arrive, and write
+// the rows of the result that they complete into the R array. Boxes can span
+// batches, so this must be called for each batch in turn, on a single thread
+static unsigned sink_scaled_rows (const unsigned char *rows, unsigned first, unsigned count, void *context)
+{
+    row_sink *sink = (row_sink *) context;
+    const decode_job *job = sink->job;
+    const unsigned factor = sink->factor, channels = job->channels;
+    const size_t row_size = (size_t) sink->width * channels, out_row_size = (size_t) job->width * channels;
+    unsigned char *data, *out;
+    unsigned done = 0;
+    
+    if (skip_rows(sink, &rows, &first, &count) == 0)
+        return 0;
+    const unsigned error = convert_rows(sink, &rows, count, &data);
+    if (error)
+        return error;
+    out = (unsigned char *) malloc((count / factor + 1) * out_row_size);
+    if (out == NULL)
+    {
+        free(data);
+        return 83;
+    }
+    
+    // Indices can't be averaged, so are subsampled instead, keeping the first row of each box
+    // The first result row written is the one whose box includes the first row, or follows it for indices
+    const unsigned offset = first - sink->skip;
+    const unsigned out_first = (job->indexed ? offset + factor - 1 : offset) / factor;
+    for (unsigned i=0; i<count; i++)
+    {
+        const unsigned char *row = rows + i * row_size;
+        if (job->indexed)
+        {
+            if ((offset + i) % factor == 0)
+                subsample_row(out + done++ * out_row_size, row, sink->width, channels, factor);
+        }
+        else
+        {
+            downscale_add_row(sink->sums, row, sink->width, channels, factor);
+            if (++sink->boxed == factor || first + i + 1 == sink->end)
+            {
+                downscale_finish_row(out + done++ * out_row_size, sink->sums, sink->width, channels, factor, sink->boxed);
+                memset(sink->sums, 0, out_row_size * sizeof(unsigned));
+                sink->boxed = 0;
+            }
+        }
+    }
+    
+    if (done > 0 && sink->image_int != NULL)
+        deinterleave_rows_int(sink->image_int, out, job->width, job->height, channels, out_first, done);
+    else if (done > 0)
+        deinterleave_rows_raw(sink->image_raw, out, job->width, job->height, channels, out_first, done);
+    free(out);
+    free(data);
+    return 0;
+}
+
+// Set the dimensions, class, nominal range and metadata of an image array
+static void set_image_attributes (SEXP image, const decode_job *job)
+{
+    SEXP dim, class, range;
+    
+    // Set the image dimensions; palette indices form a matrix
+    PROTECT(dim = Rf_allocVector(INTSXP, job->indexed ? 2 : 3));
+    int *dim_ptr = INTEGER(dim);
+    dim_ptr[0] = job->height;
+    dim_ptr[1] = job->width;
+    if (!job->indexed)
+        dim_ptr[2] = job->channels;
+    Rf_setAttrib(image, R_DimSymbol, dim);
+    
+    // Set the object class
+    PROTECT(class = Rf_allocVector(STRSXP,2));
+    SET_STRING_ELT(class, 0, Rf_mkChar("loder"));
+    SET_STRING_ELT(class, 1, Rf_mkChar("array"));
+    Rf_setAttrib(image, R_ClassSymbol, class);
+    
+    // Set the theoretical range of the data
+    PROTECT(range = Rf_allocVector(INTSXP,2));
+    INTEGER(range)[0] = 0;
+    INTEGER(range)[1] = 255;
+    Rf_setAttrib(image, Rf_install("range"), range);
+    
+    UNPROTECT(3);
+    
+    // Attach the palette to indices, as hex codes with alpha only if some colour is not opaque
+    if (job->indexed)
+    {
+        const LodePNGColorMode *color = &job->state.info_png.color;
+        Rboolean opaque = TRUE;
+        for (size_t i=0; i<color->palettesize; i++)
+        {
+            if (color->palette[4*i+3] != 255)
+                opaque = FALSE;
+        }
+        
+        SEXP palette;
+        PROTECT(palette = Rf_allocVector(STRSXP, (R_xlen_t) color->palettesize));
+        for (size_t i=0; i<color->palettesize; i++)
+        {
+            const unsigned char *entry = color->palette + 4*i;
+            char hex[10];
+            if (opaque)
+                snprintf(hex, 10, "#%02X%02X%02X", entry[0], entry[1], entry[2]);
+            else
+                snprintf(hex, 10, "#%02X%02X%02X%02X", entry[0], entry[1], entry[2], entry[3]);
+            SET_STRING_ELT(palette, i, Rf_mkChar(hex));
+        }
+        Rf_setAttrib(image, Rf_install("palette"), palette);
+        UNPROTECT(1);
+    }
+    
+    set_metadata(image, &job->state.info_png);
+}
+
+// Convert the result of a decode job into an R array
+static SEXP job_to_image (const decode_job *job, const Rboolean raw)
+{
+    const unsigned width = job->width, height = job->height, channels = job->channels;
+    SEXP image;
+    
+    // Allocate memory for the final image, with one byte per sample if raw storage is requested
+    // LodePNG returns pixel data with dimensions reversed relative to R, so we need to correct it back
+    const R_xlen_t length = (R_xlen_t) width * height * channels;
+    if (raw)
+    {
+        PROTECT(image = Rf_allocVector(RAWSXP,length));
+        deinterleave_raw(RAW(image), job->data, width, height, channels);
+    }
+    else
+    {
+        PROTECT(image = Rf_allocVector(INTSXP,length));
+        deinterleave_int(INTEGER(image), job->data, width, height, channels);
+    }
+    
+    set_image_attributes(image, job);
+    
+    UNPROTECT(1);
+    return image;
+}
+
+// Decode a single non-interlaced image in batches of rows, which are converted and
+// written straight into the R array, which is therefore allocated up front. On
+// several threads LodePNG decompresses on one and unfilters on another, while the
+// others convert rows; on one thread it keeps only a window of the decompressed
+// data, so the array is the only full-size buffer. A reduced image is built up
+// from each batch in turn, on one thread, so the full-size image never exists at
+// all. Returns NULL, having done nothing, for interlaced images
+static SEXP decode_pipelined (decode_job *job, const Rboolean raw, const int threads)
+{
+    file_contents file = { NULL, 0, 0 };
+    const unsigned char *png;
+    size_t png_size;
+    row_sink sink;
+    SEXP image = R_NilValue;
+    
+    open_job(job, &file, &png, &png_size);
+    if (!job->error && job->state.info_png.interlace_method != 0)
+    {
+        if (file.data != NULL)
+            unmap_file(&file);
+        free_decode_job(job);
+        return NULL;
+    }
+    
+    sink.sums = NULL;
+    if (!job->error)
+    {
+        // Work out which rows of the file are needed, and the dimensions of the result
+        const unsigned factor = job->scale;
+        sink.job = job;
+        sink.width = job->width;
+        sink.skip = (job->first_row > 0 ? (job->first_row - 1) * factor : 0);
+        sink.end = (job->last_row > 0 && job->last_row * factor < job->height ? job->last_row * factor : job->height);
+        sink.factor = factor;
+        sink.boxed = 0;
+        job->width = (job->width + factor - 1) / factor;
+        job->height = (job->first_row > 0 ? job->last_row - job->first_row + 1 : (job->height + factor - 1) / factor);
+        if (factor > 1)
+        {
+            sink.sums = (unsigned *) calloc((size_t) job->width * job->channels, sizeof(unsigned));
+            if (sink.sums == NULL)
+                job->error = 83;
+        }
+    }
+    
+    // The file can stay mapped until the array exists, since allocation failure is no worse than for job_to_image()
+    if (!job->error)
+    {
+        PROTECT(image = Rf_allocVector(raw ? RAWSXP : INTSXP, (R_xlen_t) job->width * job->height * job->channels));
+        sink.image_int = (raw ? NULL : INTEGER(image));
+        sink.image_raw = (raw ? RAW(image) : NULL);
+        
+        // The colour type requested is used by sink_rows() to convert rows
+        unsigned width, height;
+        job->state.info_raw.colortype = (job->state.info_png.color.colortype == LCT_PALETTE ? LCT_RGBA : job->state.info_png.color.colortype);
+        job->state.info_raw.bitdepth = 8;
+        job->state.decoder.max_rows = job->last_row * sink.factor;
+        job->state.decoder.row_callback = (sink.factor > 1 ? sink_scaled_rows : sink_rows);
+        job->state.decoder.row_context = &sink;
+        job->state.decoder.threads = (sink.factor > 1 ? 1 : (unsigned) threads);
+        job->error = lodepng_decode(&job->data, &width, &height, &job->state, png, png_size);
+    }
+    
+    free(sink.sums);
+    if (file.data != NULL)
+        unmap_file(&file);
+    if (job->error)
+    {
+        const unsigned error = job->error;
+        free_decode_job(job);
+        Rf_error("LodePNG error: %s\n", decode_error_text(error));
+    }
+    
+    scale_resolution(job);
+    set_image_attributes(image, job);
+    free_decode_job(job);
+    
+    UNPROTECT(1);
+    return image;
+}
+
+#ifdef LAZY_IMAGES
+
+// Lazy images are ALTREP vectors whose first data slot is a list containing the
+// encoded data, the image dimensions and the decoding options (the first and last
+// rows requested, or zero, the scale factor and whether indices are wanted), and whose second slot is the decoded
+// array, once something has needed it. The first slot is cleared as soon as the
+// decoded data might be modified, since the encoded data no longer match them
+static R_altrep_class_t lazy_int_class, lazy_raw_class;
+
+// Wrap the result of a lazy decode job; the source is a raw vector containing
+// the encoded data, or NULL if they were read from a file and need copying
+static SEXP job_to_lazy_image (const decode_job *job, SEXP source, const Rboolean raw)
+{
+    SEXP encoded, state, dim, options, image;
+    
+    if (Rf_isNull(source))
+    {
+        PROTECT(encoded = Rf_allocVector(RAWSXP, (R_xlen_t) job->encoded.size));
+        memcpy(RAW(encoded), job->encoded.data, job->encoded.size);
+    }
+    else
+    {
+        // The source vector is shared, so must not be modified in place from now on
+        PROTECT(encoded = source);
+        MARK_NOT_MUTABLE(encoded);
+    }
+    
+    PROTECT(state = Rf_allocVector(VECSXP,3));
+    PROTECT(dim = Rf_allocVector(INTSXP,3));
+    INTEGER(dim)[0] = job->height;
+    INTEGER(dim)[1] = job->width;
+    INTEGER(dim)[2] = job->channels;
+    PROTECT(options = Rf_allocVector(INTSXP,4));
+    INTEGER(options)[0] = job->first_row;
+    INTEGER(options)[1] = job->last_row;
+    INTEGER(options)[2] = job->scale;
+    INTEGER(options)[3] = job->indexed;
+    SET_VECTOR_ELT(state, 0, encoded);
+    SET_VECTOR_ELT(state, 1, dim);
+    SET_VECTOR_ELT(state, 2, options);
+    
+    PROTECT(image = R_new_altrep(raw ? lazy_raw_class : lazy_int_class, state, R_NilValue));
+    set_image_attributes(image, job);
+    
+    UNPROTECT(5);
+    return image;
+}
+
+// Decode the image, if this hasn't already happened, and return the decoded array
+static SEXP lazy_expand (SEXP x)
+{
+    SEXP decoded = R_altrep_data2(x);
+    if (decoded != R_NilValue)
+        return decoded;
+    
+    SEXP state = R_altrep_data1(x);
+    SEXP encoded = VECTOR_ELT(state, 0);
+    const int *dim = INTEGER(VECTOR_ELT(state, 1));
+    const Rboolean raw = (TYPEOF(x) == RAWSXP);
+    
+    // Allocate first, so that an allocation error can't leak the decoded buffer
+    PROTECT(decoded = Rf_allocVector(raw ? RAWSXP : INTSXP, (R_xlen_t) dim[0] * dim[1] * dim[2]));
+    
+    decode_job job;
+    job.filename = NULL;
+    job.buffer = RAW(encoded);
+    job.buffer_size = (size_t) XLENGTH(encoded);
+    job.lazy = FALSE;
+    job.first_row = (unsigned) INTEGER(VECTOR_ELT(state, 2))[0];
+    job.last_row = (unsigned) INTEGER(VECTOR_ELT(state, 2))[1];
+    job.scale = (unsigned) INTEGER(VECTOR_ELT(state, 2))[2];
+    job.indexed = (Rboolean) INTEGER(VECTOR_ELT(state, 2))[3];
+    job.workspace = NULL;
+    decode_file(&job);
+    
+    if (job.error)
+    {
+        const unsigned error = job.error;
+        free_decode_job(&job);
+        Rf_error("LodePNG error: %s\n", decode_error_text(error));
+    }
+    else if (job.width != (unsigned) dim[1] || job.height != (unsigned) dim[0] || job.channels != (unsigned) dim[2])
+    {
+        free_decode_job(&job);
+        Rf_error("Decoded image does not match its recorded dimensions");
+    }
+    
+    if (raw)
+        deinterleave_raw(RAW(decoded), job.data, job.width, job.height, job.channels);
+    else
+        deinterleave_int(INTEGER(decoded), job.data, job.width, job.height, job.channels);
+    free_decode_job(&job);
+    
+    R_set_altrep_data2(x, decoded);
+    UNPROTECT(1);
+    return decoded;
+}
 
-// Predefined compression levels
-// Elements are block type, use LZ77, window size, minimum LZ77 length, threshold length to stop searching, use lazy matching
-// Last three elements are for custom hooks and are not used here
-const LodePNGCompressSettings level0 = { 0, 0,  2048, 3,  16, 0, 0, 0, 0 };  // No compression
-const LodePNGCompressSettings level1 = { 1, 1,   256, 3,  32, 1, 0, 0, 0 };  // Fixed Huffman tree, small window
-const LodePNGCompressSettings level2 = { 1, 1,  1024, 3,  64, 1, 0, 0, 0 };  // Fixed Huffman tree, medium window
-const LodePNGCompressSettings level3 = { 2, 1,  1024, 3,  64, 1, 0, 0, 0 };  // Dynamic tree, medium window
-const LodePNGCompressSettings level4 = { 2, 1,  2048, 3, 128, 1, 0, 0, 0 };  // LodePNG defaults
-const LodePNGCompressSettings level5 = { 2, 1,  8192, 3, 128, 1, 0, 0, 0 };  // Dynamic tree, large window
-const LodePNGCompressSettings level6 = { 2, 1, 32768, 3, 258, 1, 0, 0, 0 };  // Maximum compression
-
-SEXP read_png (SEXP file_, SEXP require_data_)
-{
-    const Rboolean require_data = (Rf_asLogical(require_data_) == TRUE);
-    unsigned error;
-    unsigned width, height, channels = 0;
-    unsigned char *png = NULL, *data = NULL;
-    size_t png_size;
-    LodePNGState state;
+static R_xlen_t lazy_length (SEXP x)
+{
+    SEXP state = R_altrep_data1(x);
+    if (state == R_NilValue)
+        return XLENGTH(R_altrep_data2(x));
     
-    // Initialise the state object
-    lodepng_state_init(&state);
+    const int *dim = INTEGER(VECTOR_ELT(state, 1));
+    return (R_xlen_t) dim[0] * dim[1] * dim[2];
+}
+
+static Rboolean lazy_inspect (SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int))
+{
+    Rprintf(" loder lazy image (%s)\n", (R_altrep_data2(x) == R_NilValue ? "encoded" : "decoded"));
+    return TRUE;
+}
+
+// Serialise the encoded data where possible, which is both compact and sufficient
+static SEXP lazy_serialized_state (SEXP x)
+{
+    SEXP state = R_altrep_data1(x);
+    return (state == R_NilValue ? NULL : state);
+}
+
+static SEXP lazy_int_unserialize (SEXP class, SEXP state)
+{
+    return R_new_altrep(lazy_int_class, state, R_NilValue);
+}
+
+static SEXP lazy_raw_unserialize (SEXP class, SEXP state)
+{
+    return R_new_altrep(lazy_raw_class, state, R_NilValue);
+}
+
+// Copies share the encoded data, which is never modified; attributes are copied by R
+static SEXP lazy_duplicate (SEXP x, Rboolean deep)
+{
+    SEXP state = R_altrep_data1(x), decoded = R_altrep_data2(x), result;
+    if (state == R_NilValue)
+        return Rf_duplicate(decoded);
     
-    // Read the file into memory
-    const char *filename = CHAR(STRING_ELT(file_, 0));
-    error = lodepng_load_file(&png, &png_size, filename);
-    if (error)
+    PROTECT(decoded = (decoded == R_NilValue ? R_NilValue : Rf_duplicate(decoded)));
+    result = R_new_altrep(TYPEOF(x) == RAWSXP ? lazy_raw_class : lazy_int_class, state, decoded);
+    UNPROTECT(1);
+    return result;
+}
+
+static void * lazy_dataptr (SEXP x, Rboolean writeable)
+{
+    SEXP decoded = lazy_expand(x);
+    if (writeable)
+        R_set_altrep_data1(x, R_NilValue);
+    return (TYPEOF(decoded) == RAWSXP ? (void *) RAW(decoded) : (void *) INTEGER(decoded));
+}
+
+static const void * lazy_dataptr_or_null (SEXP x)
+{
+    SEXP decoded = R_altrep_data2(x);
+    if (decoded == R_NilValue)
+        return NULL;
+    else
+        return (TYPEOF(decoded) == RAWSXP ? (const void *) RAW(decoded) : (const void *) INTEGER(decoded));
+}
+
+static int lazy_int_elt (SEXP x, R_xlen_t i)
+{
+    return INTEGER(lazy_expand(x))[i];
+}
+
+static Rbyte lazy_raw_elt (SEXP x, R_xlen_t i)
+{
+    return RAW(lazy_expand(x))[i];
+}
+
+static R_xlen_t lazy_int_get_region (SEXP x, R_xlen_t i, R_xlen_t n, int *buf)
+{
+    SEXP decoded = lazy_expand(x);
+    const R_xlen_t length = XLENGTH(decoded);
+    const R_xlen_t count = (i + n > length ? length - i : n);
+    if (count > 0)
+        memcpy(buf, INTEGER(decoded) + i, count * sizeof(int));
+    return (count > 0 ? count : 0);
+}
+
+static R_xlen_t lazy_raw_get_region (SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf)
+{
+    SEXP decoded = lazy_expand(x);
+    const R_xlen_t length = XLENGTH(decoded);
+    const R_xlen_t count = (i + n > length ? length - i : n);
+    if (count > 0)
+        memcpy(buf, RAW(decoded) + i, count);
+    return (count > 0 ? count : 0);
+}
+
+static void init_lazy_classes (DllInfo *info)
+{
+    lazy_int_class = R_make_altinteger_class("lazy_int", "loder", info);
+    lazy_raw_class = R_make_altraw_class("lazy_raw", "loder", info);
+    
+    R_altrep_class_t classes[2] = { lazy_int_class, lazy_raw_class };
+    for (int i=0; i<2; i++)
     {
-        free(png);
-        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        R_set_altrep_Length_method(classes[i], lazy_length);
+        R_set_altrep_Inspect_method(classes[i], lazy_inspect);
+        R_set_altrep_Serialized_state_method(classes[i], lazy_serialized_state);
+        R_set_altrep_Duplicate_method(classes[i], lazy_duplicate);
+        R_set_altvec_Dataptr_method(classes[i], lazy_dataptr);
+        R_set_altvec_Dataptr_or_null_method(classes[i], lazy_dataptr_or_null);
     }
     
-    // Read basic metadata from the image blob
-    error = lodepng_inspect(&width, &height, &state, png, png_size);
-    if (error)
+    R_set_altrep_Unserialize_method(lazy_int_class, lazy_int_unserialize);
+    R_set_altinteger_Elt_method(lazy_int_class, lazy_int_elt);
+    R_set_altinteger_Get_region_method(lazy_int_class, lazy_int_get_region);
+    
+    R_set_altrep_Unserialize_method(lazy_raw_class, lazy_raw_unserialize);
+    R_set_altraw_Elt_method(lazy_raw_class, lazy_raw_elt);
+    R_set_altraw_Get_region_method(lazy_raw_class, lazy_raw_get_region);
+}
+
+#endif
+
+// A growing buffer for encoded data
+typedef struct {
+    unsigned char *data;
+    size_t size, capacity;
+} output_buffer;
+
+// Working memory kept between calls by an encoder or decoder object, so that
+// encoding or decoding many small images doesn't allocate it afresh each time
+// The encoder also keeps the buffer that collects its output
+typedef struct {
+    LodePNGWorkspace *workspace;
+    output_buffer buffer;
+} codec_context;
+
+static void finalise_context (SEXP context_)
+{
+    codec_context *context = (codec_context *) R_ExternalPtrAddr(context_);
+    if (context != NULL)
     {
-        free(png);
-        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        lodepng_workspace_free(context->workspace);
+        free(context->buffer.data);
+        free(context);
+        R_ClearExternalPtr(context_);
     }
-    
-    // Figure out the number of channels
-    switch (state.info_png.color.colortype)
+}
+
+// Create an encoder or decoder object, an external pointer tagged with its type
+static SEXP new_context (const char *type)
+{
+    codec_context *context = (codec_context *) malloc(sizeof(codec_context));
+    if (context == NULL)
+        Rf_error("Failed to allocate memory for the %s", type);
+    context->workspace = lodepng_workspace_new();
+    context->buffer.data = NULL;
+    context->buffer.size = context->buffer.capacity = 0;
+    if (context->workspace == NULL)
     {
-        case LCT_GREY:
-        channels = 1;
-        break;
-        
-        case LCT_GREY_ALPHA:
-        channels = 2;
-        break;
-        
-        case LCT_RGB:
-        channels = 3;
-        break;
-        
-        case LCT_PALETTE:
-        case LCT_RGBA:
-        channels = 4;
-        break;
-        
-        default:
-        Rf_error("Unexpected colour type");
+        free(context);
+        Rf_error("Failed to allocate memory for the %s", type);
     }
     
-    // Allocate memory for the final image
-    R_len_t length;
-    SEXP image, dim, class, asp, dpi, pixdim, text_keys, text_vals;
-    char background[8] = "";
-    length = (R_len_t) width * height * channels;
+    SEXP result = PROTECT(R_MakeExternalPtr(context, Rf_install(type), R_NilValue));
+    R_RegisterCFinalizerEx(result, finalise_context, TRUE);
+    UNPROTECT(1);
+    return result;
+}
+
+SEXP new_encoder (void)
+{
+    return new_context("encoder");
+}
+
+SEXP new_decoder (void)
+{
+    return new_context("decoder");
+}
+
+// Retrieve the context from an encoder or decoder object, or NULL if there isn't one
+// External pointers don't survive being saved and reloaded, so their address may be gone
+static codec_context * get_context (SEXP context_, const char *type)
+{
+    if (Rf_isNull(context_))
+        return NULL;
+    if (TYPEOF(context_) != EXTPTRSXP || R_ExternalPtrTag(context_) != Rf_install(type))
+        Rf_error("The %s is not valid", type);
     
-    // Set the required colour type and bit depth, and decode the blob
-    state.info_raw.colortype = (state.info_png.color.colortype == LCT_PALETTE ? LCT_RGBA : state.info_png.color.colortype);
-    state.info_raw.bitdepth = 8;
-    error = lodepng_decode(&data, &width, &height, &state, png, png_size);
-    free(png);
-    if (error)
+    codec_context *context = (codec_context *) R_ExternalPtrAddr(context_);
+    if (context == NULL)
+        Rf_error("The %s no longer exists, perhaps because it was saved and reloaded", type);
+    return context;
+}
+
+SEXP read_png (SEXP file_, SEXP threads_, SEXP raw_, SEXP lazy_, SEXP rows_, SEXP scale_, SEXP indexed_, SEXP decoder_)
+{
+    const Rboolean raw = (Rf_asLogical(raw_) == TRUE);
+    const Rboolean indexed = (Rf_asLogical(indexed_) == TRUE);
+#ifdef LAZY_IMAGES
+    const Rboolean lazy = (Rf_asLogical(lazy_) == TRUE);
+#else
+    const Rboolean lazy = FALSE;
+#endif
+    // A raw vector is a single encoded image; otherwise we expect file names or a list of raw vectors
+    const Rboolean single_raw = (TYPEOF(file_) == RAWSXP);
+    const R_len_t n_files = (single_raw ? 1 : Rf_length(file_));
+    int threads = Rf_asInteger(threads_);
+    const unsigned scale = (unsigned) Rf_asInteger(scale_);
+    unsigned first_row = 0, last_row = 0;
+    SEXP result;
+    
+    // A decoder's working memory can only be used by one thread at a time
+    codec_context *decoder = get_context(decoder_, "decoder");
+    if (threads == NA_INTEGER || threads < 1 || decoder != NULL)
+        threads = 1;
+    if (!single_raw && !Rf_isString(file_) && TYPEOF(file_) != VECSXP)
+        Rf_error("Source must be a character vector, a raw vector or a list of raw vectors");
+    
+    // The R code checks that the rows are positive and in order, and the scale factor is valid
+    if (!Rf_isNull(rows_))
     {
-        free(data);
-        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        first_row = (unsigned) INTEGER(rows_)[0];
+        last_row = (unsigned) INTEGER(rows_)[1];
     }
     
-    if (require_data)
+    // Files are decoded in batches, so that at most one batch of decoded buffers exists alongside the R arrays
+    const R_len_t batch_size = (n_files < 16 * threads ? n_files : 16 * threads);
+    decode_job *jobs = (decode_job *) R_alloc(batch_size > 0 ? batch_size : 1, sizeof(decode_job));
+    
+    PROTECT(result = Rf_allocVector(VECSXP, n_files));
+    for (R_len_t start=0; start<n_files; start+=batch_size)
     {
-        // LodePNG returns pixel data with dimensions reversed relative to R, so we need to correct it back
-        PROTECT(image = Rf_allocVector(INTSXP,length));
-        int *image_ptr = INTEGER(image);
-        size_t image_strides[2] = { (size_t) height, (size_t) height * width };
-        size_t data_strides[2] = { (size_t) channels, (size_t) channels * width };
-        size_t image_offset, data_offset;
-        for (unsigned i=0; i<height; i++)
-        {
-            data_offset = i * data_strides[1];
-            for (unsigned j=0; j<width; j++)
+        const R_len_t end = (start + batch_size < n_files ? start + batch_size : n_files);
+        
+        // Fetch the file names or data pointers on the main thread, since the R API is not thread-safe
+        for (R_len_t i=start; i<end; i++)
+        {
+            decode_job *job = &jobs[i-start];
+            job->filename = NULL;
+            job->buffer = NULL;
+            job->lazy = lazy;
+            job->indexed = indexed;
+            job->scale = scale;
+            job->first_row = first_row;
+            job->last_row = last_row;
+            job->workspace = (decoder == NULL ? NULL : decoder->workspace);
+            if (Rf_isString(file_))
+                job->filename = CHAR(STRING_ELT(file_, i));
+            else
             {
-                image_offset = j * image_strides[0];
-                for (unsigned k=0; k<channels; k++)
-                    image_ptr[i+image_offset+k*image_strides[1]] = (int) data[k+data_offset];
-                data_offset += data_strides[0];
+                SEXP element = (single_raw ? file_ : VECTOR_ELT(file_, i));
+                if (TYPEOF(element) != RAWSXP)
+                    Rf_error("Element %d of the source list is not a raw vector", i+1);
+                job->buffer = RAW(element);
+                job->buffer_size = (size_t) XLENGTH(element);
             }
         }
         
-        // Set the image dimensions
-        PROTECT(dim = Rf_allocVector(INTSXP,3));
-        int *dim_ptr = INTEGER(dim);
-        dim_ptr[0] = height;
-        dim_ptr[1] = width;
-        dim_ptr[2] = channels;
-        Rf_setAttrib(image, R_DimSymbol, dim);
-        
-        // Set the object class
-        PROTECT(class = Rf_allocVector(STRSXP,2));
-        SET_STRING_ELT(class, 0, Rf_mkChar("loder"));
-        SET_STRING_ELT(class, 1, Rf_mkChar("array"));
-        Rf_setAttrib(image, R_ClassSymbol, class);
-        
-        // Set the theoretical range of the data
-        SEXP range;
-        PROTECT(range = Rf_allocVector(INTSXP,2));
-        INTEGER(range)[0] = 0;
-        INTEGER(range)[1] = 255;
-        Rf_setAttrib(image, Rf_install("range"), range);
+        // A single image can instead be decoded straight into its array, in stages if threads are available
+        if (n_files == 1 && !lazy)
+        {
+            SEXP image = decode_pipelined(&jobs[0], raw, threads);
+            if (image != NULL)
+            {
+                SET_VECTOR_ELT(result, 0, image);
+                break;
+            }
+        }
         
-        UNPROTECT(3);
-    }
-    else
-    {
-        // We don't need the data, so just return the input vector with attributes
-        PROTECT(image = Rf_duplicate(file_));
+        // Load and decode the files concurrently
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+        for (R_len_t i=start; i<end; i++)
+            decode_file(&jobs[i-start]);
         
-        // Set the object class and other basic attributes
-        Rf_setAttrib(image, R_ClassSymbol, PROTECT(Rf_mkString("lodermeta")));
-        Rf_setAttrib(image, Rf_install("width"), PROTECT(Rf_ScalarInteger(width)));
-        Rf_setAttrib(image, Rf_install("height"), PROTECT(Rf_ScalarInteger(height)));
-        Rf_setAttrib(image, Rf_install("channels"), PROTECT(Rf_ScalarInteger(channels)));
-        Rf_setAttrib(image, Rf_install("bitdepth"), PROTECT(Rf_ScalarInteger(state.info_png.color.bitdepth)));
-        Rf_setAttrib(image, Rf_install("filesize"), PROTECT(Rf_ScalarReal((double) png_size)));
-        Rf_setAttrib(image, Rf_install("interlaced"), PROTECT(Rf_ScalarLogical(state.info_png.interlace_method)));
+        // Check for errors before allocating anything
+        for (R_len_t i=start; i<end; i++)
+        {
+            const decode_job *job = &jobs[i-start];
+            if (job->error)
+            {
+                const unsigned error = job->error;
+                const char *filename = job->filename;
+                for (R_len_t j=start; j<end; j++)
+                    free_decode_job(&jobs[j-start]);
+                if (n_files == 1)
+                    Rf_error("LodePNG error: %s\n", decode_error_text(error));
+                else if (filename != NULL)
+                    Rf_error("LodePNG error in file \"%s\": %s\n", filename, decode_error_text(error));
+                else
+                    Rf_error("LodePNG error in element %d: %s\n", i+1, decode_error_text(error));
+            }
+        }
         
-        // If a palette is used, capture the number of colours
-        if (state.info_png.color.colortype == LCT_PALETTE)
+        // Create the R arrays on the main thread, freeing each buffer as we go
+        for (R_len_t i=start; i<end; i++)
         {
-            Rf_setAttrib(image, Rf_install("palette"), PROTECT(Rf_ScalarInteger((int) state.info_png.color.palettesize)));
-            UNPROTECT(1);
+#ifdef LAZY_IMAGES
+            if (lazy)
+                SET_VECTOR_ELT(result, i, job_to_lazy_image(&jobs[i-start], Rf_isString(file_) ? R_NilValue : (single_raw ? file_ : VECTOR_ELT(file_, i)), raw));
+            else
+#endif
+                SET_VECTOR_ELT(result, i, job_to_image(&jobs[i-start], raw));
+            free_decode_job(&jobs[i-start]);
         }
         
-        UNPROTECT(7);
+        R_CheckUserInterrupt();
     }
     
-    // If a background colour is defined in the file, convert it to a hex code and store it
-    if (state.info_png.background_defined)
-    {
-        snprintf(background, 8, "#%X%X%X", state.info_png.background_r, state.info_png.background_g, state.info_png.background_b);
-        Rf_setAttrib(image, Rf_install("background"), PROTECT(Rf_mkString(background)));
-        UNPROTECT(1);
-    }
+    UNPROTECT(1);
+    return result;
+}
 
-    // Set the aspect ratio or DPI/pixel size if available
-    if (state.info_png.phys_defined)
+// Output functions for LodePNG's streaming encoder
+static unsigned write_to_buffer (const unsigned char *data, size_t size, void *context)
+{
+    output_buffer *buffer = (output_buffer *) context;
+    if (buffer->size + size > buffer->capacity)
     {
-        if (state.info_png.phys_unit == 0)
-        {
-            PROTECT(asp = Rf_allocVector(REALSXP,1));
-            *REAL(asp) = (double) state.info_png.phys_y / (double) state.info_png.phys_x;
-            Rf_setAttrib(image, Rf_install("asp"), asp);
-            UNPROTECT(1);
-        }
-        else
-        {
-            PROTECT(dpi = Rf_allocVector(REALSXP,2));
-            PROTECT(pixdim = Rf_allocVector(REALSXP,2));
-            REAL(dpi)[0] = (double) state.info_png.phys_x / 39.3700787402;
-            REAL(dpi)[1] = (double) state.info_png.phys_y / 39.3700787402;
-            REAL(pixdim)[0] = 1000.0 / (double) state.info_png.phys_x;
-            REAL(pixdim)[1] = 1000.0 / (double) state.info_png.phys_y;
-            Rf_setAttrib(image, Rf_install("dpi"), dpi);
-            Rf_setAttrib(image, Rf_install("pixdim"), pixdim);
-            Rf_setAttrib(image, Rf_install("pixunits"), PROTECT(Rf_mkString("mm")));
-            UNPROTECT(3);
-        }
+        size_t capacity = (buffer->capacity > 0 ? buffer->capacity : 65536);
+        while (buffer->size + size > capacity)
+            capacity *= 2;
+        unsigned char *new_data = (unsigned char *) realloc(buffer->data, capacity);
+        if (new_data == NULL)
+            return 83;
+        buffer->data = new_data;
+        buffer->capacity = capacity;
     }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return 0;
+}
+
+static unsigned write_to_file (const unsigned char *data, size_t size, void *context)
+{
+    return (fwrite(data, 1, size, (FILE *) context) == size ? 0 : 79);
+}
+
+// Convert a palette of hex colour codes, with or without alpha, to RGBA values, returning the number of entries
+static unsigned parse_palette (unsigned char *rgba, SEXP palette)
+{
+    const R_len_t n = Rf_length(palette);
+    if (TYPEOF(palette) != STRSXP || n < 1 || n > 256)
+        Rf_error("Palette must be a character vector of between 1 and 256 colours");
     
-    // Convert text chunks
-    if (state.info_png.itext_num > 0)
+    for (R_len_t i=0; i<n; i++)
     {
-        PROTECT(text_keys = Rf_allocVector(STRSXP, state.info_png.itext_num + state.info_png.text_num));
-        PROTECT(text_vals = Rf_allocVector(STRSXP, state.info_png.itext_num + state.info_png.text_num));
+        const char *code = CHAR(STRING_ELT(palette, i));
+        const size_t length = strlen(code);
+        if (code[0] != '#' || (length != 7 && length != 9) || strspn(code+1, "0123456789abcdefABCDEF") != length - 1)
+            Rf_error("Palette entry \"%s\" is not a hex colour code of the form #RRGGBB or #RRGGBBAA", code);
         
-        for (size_t i=0; i<state.info_png.itext_num; i++)
+        unsigned long value = strtoul(code+1, NULL, 16);
+        if (length == 7)
+            value = (value << 8) | 0xff;
+        rgba[4*i] = (unsigned char) (value >> 24);
+        rgba[4*i+1] = (unsigned char) ((value >> 16) & 0xff);
+        rgba[4*i+2] = (unsigned char) ((value >> 8) & 0xff);
+        rgba[4*i+3] = (unsigned char) (value & 0xff);
+    }
+    return (unsigned) n;
+}
+
+// Check that every element of an indexed image is a whole number that indexes the palette
+static Rboolean valid_indices (SEXP image, const size_t length, const unsigned n_colours)
+{
+    switch (TYPEOF(image))
+    {
+        case INTSXP:
         {
-            SET_STRING_ELT(text_keys, i, Rf_mkCharCE(state.info_png.itext_transkeys[i], CE_UTF8));
-            SET_STRING_ELT(text_vals, i, Rf_mkCharCE(state.info_png.itext_strings[i], CE_UTF8));
+            const int *values = INTEGER(image);
+            for (size_t l=0; l<length; l++)
+            {
+                if (values[l] < 0 || values[l] >= (int) n_colours)
+                    return FALSE;
+            }
+            return TRUE;
         }
-        for (size_t i=0; i<state.info_png.text_num; i++)
+        
+        case REALSXP:
         {
-            SET_STRING_ELT(text_keys, i+state.info_png.itext_num, Rf_mkChar(state.info_png.text_keys[i]));
-            SET_STRING_ELT(text_vals, i+state.info_png.itext_num, Rf_mkChar(state.info_png.text_strings[i]));
+            const double *values = REAL(image);
+            for (size_t l=0; l<length; l++)
+            {
+                if (!(values[l] >= 0.0 && values[l] < (double) n_colours) || values[l] != floor(values[l]))
+                    return FALSE;
+            }
+            return TRUE;
         }
         
-        Rf_setAttrib(text_vals, R_NamesSymbol, text_keys);
-        Rf_setAttrib(image, Rf_install("text"), text_vals);
-        UNPROTECT(2);
-    }
-    else if (state.info_png.text_num > 0)
-    {
-        PROTECT(text_keys = Rf_allocVector(STRSXP, state.info_png.text_num));
-        PROTECT(text_vals = Rf_allocVector(STRSXP, state.info_png.text_num));
-        
-        for (size_t i=0; i<state.info_png.text_num; i++)
+        case RAWSXP:
         {
-            SET_STRING_ELT(text_keys, i, Rf_mkChar(state.info_png.text_keys[i]));
-            SET_STRING_ELT(text_vals, i, Rf_mkChar(state.info_png.text_strings[i]));
+            const Rbyte *values = RAW(image);
+            for (size_t l=0; l<length; l++)
+            {
+                if (values[l] >= n_colours)
+                    return FALSE;
+            }
+            return TRUE;
         }
         
-        Rf_setAttrib(text_vals, R_NamesSymbol, text_keys);
-        Rf_setAttrib(image, Rf_install("text"), text_vals);
-        UNPROTECT(2);
+        default:
+        return FALSE;
     }
-    
-    // Tidy up
-    lodepng_state_cleanup(&state);
-    free(data);
-    
-    UNPROTECT(1);
-    return image;
 }
 
-SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace_)
+// Pack one-byte palette indices into fewer bits in place, with no padding between rows, as LodePNG expects
+static void pack_indices (unsigned char *data, const size_t n, const unsigned bitdepth)
+{
+    const unsigned per_byte = 8 / bitdepth;
+    for (size_t l=0; l<n; l+=per_byte)
+    {
+        unsigned char byte = 0;
+        for (unsigned q=0; q<per_byte && l+q<n; q++)
+            byte |= (unsigned char) (data[l+q] << (8 - bitdepth * (q + 1)));
+        data[l / per_byte] = byte;
+    }
+}
+
+SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace_, SEXP encoder_, SEXP threads_, SEXP seekable_)
 {
     const int compression_level = Rf_asInteger(compression_level_);
     const Rboolean interlace = (Rf_asLogical(interlace_) == TRUE);
+    codec_context *encoder = get_context(encoder_, "encoder");
     unsigned width, height, channels;
     
     // Read the image dimensions from the source object
@@ -249,23 +1552,59 @@ SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace
         channels = 1;
     else
         channels = dim_ptr[2];
+    if (channels < 1 || channels > 4)
+        Rf_error("Image must have between 1 and 4 channels");
+    
+    // Seekable images are compressed in independent segments of rows, by default about 1 MiB of data each
+    unsigned restart_rows = 0;
+    if (Rf_isLogical(seekable_))
+    {
+        if (Rf_asLogical(seekable_) == TRUE)
+        {
+            const size_t row_size = (size_t) width * channels + 1;
+            restart_rows = (row_size >= 1048576 ? 1 : (unsigned) (1048576 / row_size));
+        }
+    }
+    else
+    {
+        const int rows = Rf_asInteger(seekable_);
+        if (rows == NA_INTEGER || rows < 1)
+            Rf_error("Seekable segments must contain at least one row");
+        restart_rows = (unsigned) rows;
+    }
     
-    // Check that the image data is numeric, then coerce it to double
+    // Check that the image data is numeric, logical or raw
+    // Each type is read in place, so there is no need to coerce it
     const int image_type = TYPEOF(image_);
-    SEXP image;
-    double *image_ptr;
-    if (image_type != INTSXP && image_type != LGLSXP && image_type != REALSXP)
-        Rf_error("Image data must be numeric or logical");
-    PROTECT(image = Rf_coerceVector(image_, REALSXP));
-    image_ptr = REAL(image);
+    if (image_type != INTSXP && image_type != LGLSXP && image_type != REALSXP && image_type != RAWSXP)
+        Rf_error("Image data must be numeric, logical or raw");
     
     double min = R_PosInf, max = R_NegInf;
-    Rboolean add_alpha = FALSE;
-    R_len_t length = (R_len_t) width * height * channels;
+    size_t length = (size_t) width * height * channels;
+    
+    // A palette attribute means that the image contains indices into it, to be written as they are
+    SEXP palette = Rf_getAttrib(image_, Rf_install("palette"));
+    unsigned char colours[1024];
+    unsigned n_colours = 0, bitdepth = 8;
+    if (!Rf_isNull(palette))
+    {
+        n_colours = parse_palette(colours, palette);
+        if (channels != 1)
+            Rf_error("Indexed images must have a single channel");
+        if (!valid_indices(image_, length, n_colours))
+            Rf_error("Image values must be whole numbers between 0 and %u, to index the palette", n_colours - 1);
+        bitdepth = (n_colours <= 2 ? 1 : (n_colours <= 4 ? 2 : (n_colours <= 16 ? 4 : 8)));
+    }
     
     // Check for a range attribute, or calculate from data
+    // Indices are known to lie within [0,255], where quantisation leaves them unchanged
     SEXP range = Rf_getAttrib(image_, Rf_install("range"));
-    if (!Rf_isNull(range) && Rf_length(range) == 2)
+    if (n_colours > 0)
+    {
+        min = 0.0;
+        max = 255.0;
+    }
+    else if (!Rf_isNull(range) && Rf_length(range) == 2)
     {
         SEXP dbl_range;
         PROTECT(dbl_range = Rf_coerceVector(range, REALSXP));
@@ -274,65 +1613,46 @@ SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace
         max = (range_ptr[0] > range_ptr[1] ? range_ptr[0] : range_ptr[1]);
         UNPROTECT(1);
     }
-    else if (image_type == LGLSXP)
+    else if (image_type == LGLSXP || image_type == RAWSXP)
     {
         min = 0.0;
         max = 255.0;
     }
+    else if (image_type == INTSXP)
+        range_int(INTEGER(image_), length, &min, &max);
     else
-    {
-        for (R_len_t l=0; l<length; l++)
-        {
-            const double value = ((double *) image_ptr)[l];
-            if (ISNA(value))
-            {
-                if (!add_alpha && channels % 2 == 1)
-                    add_alpha = TRUE;
-            }
-            else
-            {
-                if (value < min)
-                    min = value;
-                if (value > max)
-                    max = value;
-            }
-        }
-    }
+        range_real(REAL(image_), length, &min, &max);
     
     if (min == max)
         Rf_warning("Image is totally flat");
     
-    // if (add_alpha)
-    //     channels++;
-    
-    double range_width = max - min;
     unsigned error;
     unsigned char *png = NULL, *data;
-    size_t png_size = (size_t) height * width * channels;
+    size_t png_size;
     LodePNGState state;
     
     // Convert to final unsigned char form, quantising as necessary
-    data = (unsigned char *) R_alloc(png_size, 1);
-    unsigned char *data_ptr = data;
-    size_t image_stride = (size_t) height * width;
-    size_t data_offset;
-    for (unsigned i=0; i<height; i++)
+    data = (unsigned char *) R_alloc((size_t) height * width * channels, 1);
+    switch (image_type)
     {
-        for (unsigned j=0; j<width; j++)
-        {
-            data_offset = j * height;
-            for (unsigned k=0; k<channels; k++)
-            {
-                const double value = round((image_ptr[i+data_offset+k*image_stride] - min) / range_width * 255.0);
-                if (value < 0.0)
-                    *data_ptr++ = 0;
-                else if (value > 255.0)
-                    *data_ptr++ = 255;
-                else
-                    *data_ptr++ = (unsigned char) value;
-            }
-        }
+        case INTSXP:
+        interleave_int(data, INTEGER(image_), width, height, channels, min, max);
+        break;
+        
+        case LGLSXP:
+        interleave_int(data, LOGICAL(image_), width, height, channels, min, max);
+        break;
+        
+        case REALSXP:
+        interleave_real(data, REAL(image_), width, height, channels, min, max);
+        break;
+        
+        case RAWSXP:
+        interleave_raw(data, RAW(image_), width, height, channels, min, max);
+        break;
     }
+    if (bitdepth < 8)
+        pack_indices(data, (size_t) height * width, bitdepth);
     
     // Initialise the state object
     lodepng_state_init(&state);
@@ -346,6 +1666,20 @@ SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace
         case 4: state.info_raw.colortype = LCT_RGBA;        break;
     }
     
+    // Give LodePNG the palette and packed indices in their final form, so that it need
+    // not analyse the colours or look up every pixel in the palette
+    if (n_colours > 0)
+    {
+        state.encoder.auto_convert = 0;
+        state.info_raw.colortype = state.info_png.color.colortype = LCT_PALETTE;
+        state.info_raw.bitdepth = state.info_png.color.bitdepth = bitdepth;
+        for (unsigned i=0; i<n_colours; i++)
+        {
+            lodepng_palette_add(&state.info_raw, colours[4*i], colours[4*i+1], colours[4*i+2], colours[4*i+3]);
+            lodepng_palette_add(&state.info_png.color, colours[4*i], colours[4*i+1], colours[4*i+2], colours[4*i+3]);
+        }
+    }
+    
     // Check for a background attribute and attach it to the state if present
     SEXP background = Rf_getAttrib(image_, Rf_install("background"));
     if (!Rf_isNull(background))
@@ -358,6 +1692,24 @@ SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace
             state.info_png.background_g = (unsigned) (value & 0x00ff00) >> 8;
             state.info_png.background_b = (unsigned) (value & 0x0000ff);
         }
+        
+        // The background of an indexed image must be a palette entry, and is stored as its index
+        if (state.info_png.background_defined && n_colours > 0)
+        {
+            unsigned i;
+            for (i=0; i<n_colours; i++)
+            {
+                if (colours[4*i] == state.info_png.background_r && colours[4*i+1] == state.info_png.background_g && colours[4*i+2] == state.info_png.background_b)
+                    break;
+            }
+            if (i < n_colours)
+                state.info_png.background_r = i;
+            else
+            {
+                state.info_png.background_defined = 0;
+                Rf_warning("Background colour is not in the palette, so will not be stored");
+            }
+        }
     }
     
     // Check for a DPI or aspect ratio attribute (in that order of preference)
@@ -418,35 +1770,84 @@ SEXP write_png (SEXP image_, SEXP file_, SEXP compression_level_, SEXP interlace
         case 5: state.encoder.zlibsettings = level5; break;
         case 6: state.encoder.zlibsettings = level6; break;
     }
+    if (encoder != NULL)
+        state.encoder.zlibsettings.workspace = encoder->workspace;
     
-    // Encode the data in memory
-    const char *filename = CHAR(STRING_ELT(file_, 0));
-    error = lodepng_encode(&png, &png_size, data, width, height, &state);
-    if (error)
+    state.encoder.restart_rows = restart_rows;
+    
+    // Large images can be compressed in segments, concurrently
+#ifdef _OPENMP
+    const int threads = Rf_asInteger(threads_);
+    if (threads != NA_INTEGER && threads > 1)
+        state.encoder.zlibsettings.threads = (unsigned) threads;
+#endif
+    
+    SEXP result = R_NilValue;
+    // The encoder passes its output on as it goes, so png and png_size are never set
+    if (Rf_isNull(file_))
     {
-        free(png);
-        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        // No file, so collect the encoded data in a buffer and return them as a raw vector
+        // The buffer grows with realloc(), so it can't be R-owned and must be copied once
+        // An encoder object keeps its buffer for next time, rather than freeing it
+        output_buffer buffer = { NULL, 0, 0 };
+        if (encoder != NULL)
+        {
+            buffer = encoder->buffer;
+            buffer.size = 0;
+        }
+        state.encoder.custom_output = write_to_buffer;
+        state.encoder.output_context = &buffer;
+        error = lodepng_encode(&png, &png_size, data, width, height, &state);
+        lodepng_state_cleanup(&state);
+        if (encoder != NULL)
+            encoder->buffer = buffer;
+        if (error)
+        {
+            if (encoder == NULL)
+                free(buffer.data);
+            Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        }
+        
+        PROTECT(result = Rf_allocVector(RAWSXP, (R_xlen_t) buffer.size));
+        memcpy(RAW(result), buffer.data, buffer.size);
+        if (encoder == NULL)
+            free(buffer.data);
+        UNPROTECT(1);
     }
-    
-    // Save to file
-    lodepng_save_file(png, png_size, filename);
-    if (error)
+    else
     {
-        free(png);
-        Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
+        // Stream the encoded data to the file as they are produced
+        const char *filename = CHAR(STRING_ELT(file_, 0));
+        FILE *file = fopen(filename, "wb");
+        if (file == NULL)
+            error = 79;
+        else
+        {
+            state.encoder.custom_output = write_to_file;
+            state.encoder.output_context = file;
+            error = lodepng_encode(&png, &png_size, data, width, height, &state);
+            if (fclose(file) != 0 && !error)
+                error = 79;
+            
+            // Don't leave a partial file behind
+            if (error)
+                remove(filename);
+        }
+        lodepng_state_cleanup(&state);
+        if (error)
+            Rf_error("LodePNG error: %s\n", lodepng_error_text(error));
     }
     
-    // Tidy up
-    lodepng_state_cleanup(&state);
-    free(png);
-    
-    UNPROTECT(1);
-    return R_NilValue;
+    return result;
 }
 
 static R_CallMethodDef callMethods[] = {
-    { "read_png",   (DL_FUNC) &read_png,    2 },
-    { "write_png",  (DL_FUNC) &write_png,   4 },
+    { "inspect_png",        (DL_FUNC) &inspect_png,         1 },
+    { "inspect_png_batch",  (DL_FUNC) &inspect_png_batch,   2 },
+    { "read_png",           (DL_FUNC) &read_png,            8 },
+    { "write_png",          (DL_FUNC) &write_png,           7 },
+    { "new_encoder",        (DL_FUNC) &new_encoder,         0 },
+    { "new_decoder",        (DL_FUNC) &new_decoder,         0 },
     { NULL, NULL, 0 }
 };
 
@@ -455,4 +1856,8 @@ void R_init_loder (DllInfo *info)
    R_registerRoutines(info, NULL, callMethods, NULL, NULL);
    R_useDynamicSymbols(info, FALSE);
    R_forceSymbols(info, TRUE);
+
+#ifdef LAZY_IMAGES
+   init_lazy_classes(info);
+#endif
 }
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+
+#include "lodepng.h"
+#include "mapfile.h"
+
+// Memory mapping is used wherever POSIX mmap() is available
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPFILE_MMAP
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+unsigned map_file (file_contents *contents, const char *filename)
+{
+    contents->data = NULL;
+    contents->size = 0;
+    contents->mapped = 0;
+
+#ifdef MAPFILE_MMAP
+    const int fd = open(filename, O_RDONLY);
+    if (fd >= 0)
+    {
+        // Empty files and anything other than a regular file are left to the fallback
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 && (uintmax_t) info.st_size <= SIZE_MAX)
+        {
+            void *data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                // The data are read from start to finish, so encourage aggressive readahead
+#ifdef MADV_SEQUENTIAL
+                madvise(data, (size_t) info.st_size, MADV_SEQUENTIAL);
+#endif
+                contents->data = (unsigned char *) data;
+                contents->size = (size_t) info.st_size;
+                contents->mapped = 1;
+            }
+        }
+        
+        // The mapping remains valid after the descriptor is closed
+        close(fd);
+        if (contents->mapped)
+            return 0;
+    }
+#endif
+    
+    // Read the whole file into a heap buffer
+    return lodepng_load_file(&contents->data, &contents->size, filename);
+}
+
+void unmap_file (file_contents *contents)
+{
+#ifdef MAPFILE_MMAP
+    if (contents->mapped)
+        munmap(contents->data, contents->size);
+    else
+#endif
+        free(contents->data);
+    
+    contents->data = NULL;
+    contents->size = 0;
+    contents->mapped = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef _MAPFILE_H_
+#define _MAPFILE_H_
+
+#include <stddef.h>
+
+// The contents of a file, mapped into memory where possible or otherwise read into a buffer
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    int mapped;
+} file_contents;
+
+// Load a file, returning zero or a LodePNG error code; the contents are read-only either way
+unsigned map_file (file_contents *contents, const char *filename);
+
+// Release the contents, however they were loaded
+void unmap_file (file_contents *contents);
+
+#endif
@@ -0,0 +1,102 @@
+// Timings for the conversion of decoded pixel data to R's array layout, on its own,
+// against the simple loop that it replaced, for 4k and 16k square images; the 16k
+// greyscale case needs about 3 GiB of memory, and the 16k RGB case about 8 GiB
+// Build and run from the package directory with, for example,
+//   cc -O2 -o benchmark-deinterleave tools/benchmark-deinterleave.c src/deinterleave.c
+//   ./benchmark-deinterleave [-rgb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/deinterleave.h"
+
+// The loop previously used by job_to_image(), for comparison
+#define DEFINE_SCALAR_DEINTERLEAVE(name, type) \
+static void name (type *image, const unsigned char *data, const unsigned width, const unsigned height, const unsigned channels) \
+{ \
+    const size_t plane = (size_t) height * width; \
+    size_t data_offset = 0; \
+    for (unsigned i=0; i<height; i++) \
+    { \
+        for (unsigned j=0; j<width; j++) \
+        { \
+            for (unsigned k=0; k<channels; k++) \
+                image[i + (size_t) j * height + k * plane] = (type) data[data_offset + k]; \
+            data_offset += channels; \
+        } \
+    } \
+}
+
+DEFINE_SCALAR_DEINTERLEAVE(scalar_deinterleave_int, int)
+DEFINE_SCALAR_DEINTERLEAVE(scalar_deinterleave_raw, unsigned char)
+
+static double now (void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + 1e-9 * (double) time.tv_nsec;
+}
+
+// Time one conversion function, returning the median over three runs
+#define DEFINE_TIMER(name, type) \
+static double name (void (*convert)(type *, const unsigned char *, const unsigned, const unsigned, const unsigned), type *image, const unsigned char *data, const unsigned size, const unsigned channels) \
+{ \
+    double times[3]; \
+    for (int r=0; r<3; r++) \
+    { \
+        const double start = now(); \
+        convert(image, data, size, size, channels); \
+        times[r] = now() - start; \
+    } \
+    const double lo = (times[0] < times[1] ? times[0] : times[1]), hi = (times[0] < times[1] ? times[1] : times[0]); \
+    return (times[2] < lo ? lo : (times[2] > hi ? hi : times[2])); \
+}
+
+DEFINE_TIMER(time_int, int)
+DEFINE_TIMER(time_raw, unsigned char)
+
+static int benchmark (const unsigned size, const unsigned channels)
+{
+    const size_t length = (size_t) size * size * channels;
+    unsigned char *data = (unsigned char *) malloc(length);
+    int *image_int = (int *) malloc(length * sizeof(int)), *reference_int = (int *) malloc(length * sizeof(int));
+    unsigned char *image_raw = (unsigned char *) malloc(length), *reference_raw = (unsigned char *) malloc(length);
+    if (data == NULL || image_int == NULL || reference_int == NULL || image_raw == NULL || reference_raw == NULL)
+    {
+        fprintf(stderr, "Not enough memory for %u x %u x %u\n", size, size, channels);
+        free(data); free(image_int); free(reference_int); free(image_raw); free(reference_raw);
+        return 1;
+    }
+    
+    srand(size + channels);
+    for (size_t l=0; l<length; l++)
+        data[l] = (unsigned char) rand();
+    
+    const double scalar_int = time_int(scalar_deinterleave_int, reference_int, data, size, channels);
+    const double tiled_int = time_int(deinterleave_int, image_int, data, size, channels);
+    const double scalar_raw = time_raw(scalar_deinterleave_raw, reference_raw, data, size, channels);
+    const double tiled_raw = time_raw(deinterleave_raw, image_raw, data, size, channels);
+    const int same = (memcmp(image_int, reference_int, length * sizeof(int)) == 0 && memcmp(image_raw, reference_raw, length) == 0);
+    
+    printf("%5u %8u %11.3f %11.3f %8.1f %11.3f %11.3f %8.1f %s\n", size, channels, scalar_int, tiled_int, scalar_int / tiled_int, scalar_raw, tiled_raw, scalar_raw / tiled_raw, same ? "" : "MISMATCH");
+    
+    free(data); free(image_int); free(reference_int); free(image_raw); free(reference_raw);
+    return !same;
+}
+
+int main (int argc, char **argv)
+{
+    const int rgb = (argc > 1 && strcmp(argv[1], "-rgb") == 0);
+    int failed = 0;
+    
+    printf(" size channels  int scalar   int tiled  speedup  raw scalar   raw tiled  speedup\n");
+    for (unsigned channels=1; channels<=4; channels++)
+        failed |= benchmark(4096, channels);
+    failed |= benchmark(16384, 1);
+    if (rgb)
+        failed |= benchmark(16384, 3);
+    
+    return failed;
+}